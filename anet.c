@@ -118,6 +118,16 @@ int anetSetSendBuffer(char *err, int fd, int buffsize)
     return ANET_OK;
 }
 
+int anetSetReceiveBuffer(char *err, int fd, int buffsize)
+{
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void*)&buffsize, sizeof(buffsize)) == -1)
+    {
+        anetSetError(err, "setsockopt SO_RCVBUF: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+}
+
 int anetTcpKeepAlive(char *err, int fd)
 {
     int yes = 1;
@@ -147,7 +157,7 @@ static int anetCreateSocket(char *err, int domain)
 
 #define ANET_CONNECT_NONE 0
 #define ANET_CONNECT_NONBLOCK 1
-static int anetTcpGenericConnect(char *err, char *addr, char *service, int flags)
+static int anetTcpGenericConnect(char *err, char *addr, char *service, int flags, int rcvbuf)
 {
     int s;
     struct addrinfo gai_hints;
@@ -178,6 +188,13 @@ static int anetTcpGenericConnect(char *err, char *addr, char *service, int flags
                 return ANET_ERR;
         }
 
+        /* The window scale is agreed on in the handshake, so a large
+         * receive buffer only helps if it is set before connecting */
+        if (rcvbuf > 0 && anetSetReceiveBuffer(err,s,rcvbuf) != ANET_OK) {
+            close(s);
+            continue;
+        }
+
         if (connect(s, p->ai_addr, p->ai_addrlen) >= 0) {
             freeaddrinfo(gai_result);
             return s;
@@ -198,12 +215,19 @@ static int anetTcpGenericConnect(char *err, char *addr, char *service, int flags
 
 int anetTcpConnect(char *err, char *addr, char *service)
 {
-    return anetTcpGenericConnect(err,addr,service,ANET_CONNECT_NONE);
+    return anetTcpGenericConnect(err,addr,service,ANET_CONNECT_NONE,0);
+}
+
+/* Blocking connect with a receive buffer of 'rcvbuf' bytes, for streams
+ * that must not stall the sender */
+int anetTcpConnectRecvBuffer(char *err, char *addr, char *service, int rcvbuf)
+{
+    return anetTcpGenericConnect(err,addr,service,ANET_CONNECT_NONE,rcvbuf);
 }
 
 int anetTcpNonBlockConnect(char *err, char *addr, char *service)
 {
-    return anetTcpGenericConnect(err,addr,service,ANET_CONNECT_NONBLOCK);
+    return anetTcpGenericConnect(err,addr,service,ANET_CONNECT_NONBLOCK,0);
 }
 
 /* Like read(2) but make sure 'count' is read before to return
@@ -64,6 +64,7 @@
 
 int anetTcpConnect(char *err, char *addr, char *service);
 int anetTcpNonBlockConnect(char *err, char *addr, char *service);
+int anetTcpConnectRecvBuffer(char *err, char *addr, char *service, int rcvbuf);
 int anetRead(int fd, char *buf, int count);
 int anetTcpServer(char *err, char *service, char *bindaddr, int *fds, int nfds);
 int anetTcpAccept(char *err, int serversock);
@@ -72,5 +73,6 @@ int anetNonBlock(char *err, int fd);
 int anetTcpNoDelay(char *err, int fd);
 int anetTcpKeepAlive(char *err, int fd);
 int anetSetSendBuffer(char *err, int fd, int buffsize);
+int anetSetReceiveBuffer(char *err, int fd, int buffsize);
 
 #endif
@@ -0,0 +1,226 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// channelizer.c: polyphase filter bank, splits a wideband I/Q stream into
+// bands at the demodulator sample rate.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Shifting the input down to each band center, low-pass filtering it and
+// keeping every decimation-th sample would cost a complex mixer and a whole
+// FIR filter per band. A polyphase filter bank does the same for all of
+// them at once: the prototype low-pass filter is split in 'bands' branches
+// (taps r, r + bands, r + 2 * bands...), each branch filters the input once
+// per output sample, and a 'bands' point DFT of the branch outputs gives
+// the output sample of every band. The bands overlap by half (decimation
+// is bands / 2), so that channels near the edge of one band are in the
+// middle of the next one, away from the filter skirts.
+// Only the bands that are wanted are evaluated in the DFT: with 4 or 8
+// branches, going through a few bands directly is cheaper than an FFT of
+// all of them.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "channelizer.h"
+
+#define OUTPUT_BLOCK 256            // Output samples per band handed over at once
+#define MAX_TAPS     (CHANNELIZER_MAX_BANDS * CHANNELIZER_TAPS_PER_BAND)
+
+struct channelizer {
+    // Prototype low-pass filter, unity gain at DC
+    float coeff[MAX_TAPS] __attribute__((aligned(16)));
+
+    // Input history, newest sample first. It is stored twice in a row, so
+    // that the last 'taps' samples always start at hist_re + pos in one
+    // piece.
+    float hist_re[MAX_TAPS * 2], hist_im[MAX_TAPS * 2];
+    unsigned pos;
+    unsigned phase;                 // Input samples to go until the next output
+
+    // DFT over the branches: e^(2 * pi * i * band * branch / bands)
+    float twiddle_re[CHANNELIZER_MAX_BANDS][CHANNELIZER_MAX_BANDS];
+    float twiddle_im[CHANNELIZER_MAX_BANDS][CHANNELIZER_MAX_BANDS];
+
+    unsigned bands, decimation, taps;
+    uint32_t wanted;
+    uint64_t outputs;               // Output samples so far
+
+    int8_t out[CHANNELIZER_MAX_BANDS][OUTPUT_BLOCK * 2];
+    unsigned nout;
+
+    channelizer_output_fn output;
+    void *opaque;
+};
+
+struct channelizer *channelizer_create(unsigned bands, uint32_t wanted, channelizer_output_fn output, void *opaque) {
+    struct channelizer *c;
+    double center, t, sum;
+    unsigned n, b, r;
+
+    if (bands < 4 || bands > CHANNELIZER_MAX_BANDS || (bands & (bands - 1)))
+        return NULL;
+    if (!wanted || (wanted >> bands) || !output)
+        return NULL;
+    if (!(c = malloc(sizeof(*c))))
+        return NULL;
+
+    c->bands = bands;
+    c->decimation = bands / 2;
+    c->taps = bands * CHANNELIZER_TAPS_PER_BAND;
+    c->wanted = wanted;
+    c->output = output;
+    c->opaque = opaque;
+
+    // Blackman windowed sinc, cut off at half the output rate
+    center = (c->taps - 1) / 2.;
+    for (n = 0, sum = 0; n < c->taps; n++) {
+        t = n - center;
+        c->coeff[n] = sin(2. * M_PI * t / bands) / (M_PI * t) *
+                      (0.42 - 0.5 * cos(2. * M_PI * n / (c->taps - 1)) + 0.08 * cos(4. * M_PI * n / (c->taps - 1)));
+        sum += c->coeff[n];
+    }
+    for (n = 0; n < c->taps; n++)
+        c->coeff[n] /= sum;
+
+    for (b = 0; b < bands; b++) {
+        for (r = 0; r < bands; r++) {
+            c->twiddle_re[b][r] = cos(2. * M_PI * b * r / bands);
+            c->twiddle_im[b][r] = sin(2. * M_PI * b * r / bands);
+        }
+    }
+
+    channelizer_reset(c);
+    return c;
+}
+
+double channelizer_delay(const struct channelizer *c) {
+    return (c->taps - 1) / 2.;
+}
+
+void channelizer_reset(struct channelizer *c) {
+    memset(c->hist_re, 0, sizeof(c->hist_re));
+    memset(c->hist_im, 0, sizeof(c->hist_im));
+    c->pos = 0;
+    c->phase = 0;
+    c->outputs = 0;
+    c->nout = 0;
+}
+
+// Run the newest input samples through every branch of the filter
+static void branchSums(const struct channelizer *c, float *sum_re, float *sum_im) {
+    const float *re = c->hist_re + c->pos, *im = c->hist_im + c->pos;
+    unsigned p, r;
+
+#ifdef __SSE2__
+    // 4 branches per vector, same order of additions as below
+    for (r = 0; r < c->bands; r += 4) {
+        __m128 acc_re = _mm_setzero_ps(), acc_im = _mm_setzero_ps(), h;
+
+        for (p = r; p < c->taps; p += c->bands) {
+            h = _mm_load_ps(c->coeff + p);
+            acc_re = _mm_add_ps(acc_re, _mm_mul_ps(h, _mm_loadu_ps(re + p)));
+            acc_im = _mm_add_ps(acc_im, _mm_mul_ps(h, _mm_loadu_ps(im + p)));
+        }
+        _mm_storeu_ps(sum_re + r, acc_re);
+        _mm_storeu_ps(sum_im + r, acc_im);
+    }
+#else
+    for (r = 0; r < c->bands; r++) {
+        sum_re[r] = sum_im[r] = 0;
+        for (p = r; p < c->taps; p += c->bands) {
+            sum_re[r] += c->coeff[p] * re[p];
+            sum_im[r] += c->coeff[p] * im[p];
+        }
+    }
+#endif
+}
+
+static int8_t saturate(float v) {
+    long s = lrintf(v);
+
+    return s > 127 ? 127 : s < -128 ? -128 : s;
+}
+
+static void flushOutput(struct channelizer *c) {
+    unsigned b;
+
+    if (!c->nout)
+        return;
+    for (b = 0; b < c->bands; b++) {
+        if (c->wanted & (1U << b))
+            c->output(c->opaque, b, c->out[b], c->nout);
+    }
+    c->nout = 0;
+}
+
+// Compute one output sample of every wanted band
+static void bandOutputs(struct channelizer *c) {
+    float sum_re[CHANNELIZER_MAX_BANDS], sum_im[CHANNELIZER_MAX_BANDS];
+    float re, im;
+    unsigned b, r;
+
+    branchSums(c, sum_re, sum_im);
+
+    for (b = 0; b < c->bands; b++) {
+        if (!(c->wanted & (1U << b)))
+            continue;
+
+        for (r = 0, re = im = 0; r < c->bands; r++) {
+            re += sum_re[r] * c->twiddle_re[b][r] - sum_im[r] * c->twiddle_im[b][r];
+            im += sum_re[r] * c->twiddle_im[b][r] + sum_im[r] * c->twiddle_re[b][r];
+        }
+
+        // Shifting band b down to 0 Hz is a rotation by -2 * pi * b / bands
+        // per input sample, half a turn per output sample for odd bands
+        if ((b & c->outputs) & 1) {
+            re = -re;
+            im = -im;
+        }
+
+        c->out[b][c->nout * 2] = saturate(re);
+        c->out[b][c->nout * 2 + 1] = saturate(im);
+    }
+
+    c->outputs++;
+    if (++c->nout == OUTPUT_BLOCK)
+        flushOutput(c);
+}
+
+void channelizer_feed(struct channelizer *c, const int8_t *iq, size_t n) {
+    size_t k;
+
+    for (k = 0; k < n; k++, iq += 2) {
+        c->pos = (c->pos ? c->pos : c->taps) - 1;
+        c->hist_re[c->pos] = c->hist_re[c->pos + c->taps] = iq[0];
+        c->hist_im[c->pos] = c->hist_im[c->pos + c->taps] = iq[1];
+
+        if (c->phase) {
+            c->phase--;
+            continue;
+        }
+        c->phase = c->decimation - 1;
+        bandOutputs(c);
+    }
+
+    flushOutput(c);
+}
+
+void channelizer_destroy(struct channelizer *c) {
+    free(c);
+}
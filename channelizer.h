@@ -0,0 +1,58 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// channelizer.h: polyphase filter bank, splits a wideband I/Q stream into
+// bands at the demodulator sample rate.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The input is split in 'bands' bands, centered every input_rate / bands
+// (band b at b * input_rate / bands, the upper half of them being the
+// negative frequencies), and each band comes out decimated by bands / 2.
+// Bands are twice as wide as they are apart, so anything within a quarter
+// of the output rate of a band center comes out of that band unharmed.
+#define CHANNELIZER_MAX_BANDS     8
+#define CHANNELIZER_TAPS_PER_BAND 8         // Prototype filter length, per band
+
+// Called with every block of output samples of each band that was asked
+// for: n signed 8-bit I/Q pairs. The block is only valid during the call.
+typedef void (*channelizer_output_fn)(void *opaque, unsigned band, const int8_t *iq, size_t n);
+
+struct channelizer;
+
+// 'bands' is a power of 2, from 4 to CHANNELIZER_MAX_BANDS. 'wanted' has bit
+// b set for every band b to compute, the others cost nothing. Returns NULL
+// if the arguments are invalid or we are out of memory.
+struct channelizer *channelizer_create(unsigned bands, uint32_t wanted, channelizer_output_fn output, void *opaque);
+
+// Filter delay, in input samples: output sample m of every band is the
+// signal around input sample m * decimation - channelizer_delay()
+double channelizer_delay(const struct channelizer *c);
+
+// Forget the signal history. The next input sample is the first one of
+// output sample 0.
+void channelizer_reset(struct channelizer *c);
+
+// Split n signed 8-bit I/Q pairs. Whatever output is pending at the end is
+// handed over before returning.
+void channelizer_feed(struct channelizer *c, const int8_t *iq, size_t n);
+
+void channelizer_destroy(struct channelizer *c);
+
+#endif
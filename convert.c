@@ -0,0 +1,303 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// convert.c: input sample formats, converted to the signed 8-bit I/Q pairs
+// the decoder takes.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Every converter goes through the input in blocks of CONVERT_BLOCK pairs,
+// 8 pairs per vector. The DC offset is only updated between blocks, so
+// within one it is a constant that the vectors subtract along with the
+// conversion, while they add up the input for the next update. The offset
+// follows a single pole low-pass filter, run at the block rate, that
+// starts from the mean of the first block.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "convert.h"
+
+#define CONVERT_BLOCK 4096          // I/Q pairs between updates of the DC offset
+#define DC_CUTOFF     1.0           // Of the DC offset filter, Hz
+
+struct converter_state {
+    int filter_dc;
+    int primed;                     // Whether dc holds an estimate yet
+    float dc[2];                    // DC offset of I and Q, in output units
+    double dc_rate;                 // 2 * pi * DC_CUTOFF / sample rate
+};
+
+// Convert n pairs, minus the DC offset in 'state', and add the input up
+// in sum[0] (I) and sum[1] (Q), in output units
+typedef void (*block_fn)(const void *in, int8_t *out, size_t n, const struct converter_state *state, double sum[2]);
+
+static const struct {
+    const char *name;
+    unsigned bytes;
+} formats[] = {
+    [INPUT_CU8]  = { "cu8",  2 },
+    [INPUT_CS8]  = { "cs8",  2 },
+    [INPUT_CS16] = { "cs16", 4 },
+    [INPUT_CF32] = { "cf32", 8 },
+};
+
+static int clampInt(long v, long lo, long hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+#ifdef __SSE2__
+static int64_t sum64(__m128i v) {
+    int64_t lanes[2];
+
+    _mm_storeu_si128((__m128i *) lanes, v);
+    return lanes[0] + lanes[1];
+}
+#endif
+
+// DC offset in output units, rounded to the given step
+static int offsetOf(const struct converter_state *state, int q, float step, long limit) {
+    return state->filter_dc ? clampInt(lrintf(state->dc[q] * step), -limit, limit) : 0;
+}
+
+static void blockCU8(const void *in, int8_t *out, size_t n, const struct converter_state *state, double sum[2]) {
+    const uint8_t *iq = in;
+    int di = offsetOf(state, 0, 1, 127), dq = offsetOf(state, 1, 1, 127);
+    int64_t si = 0, sq = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // 255 - 127 - di and 0 - 127 - di must saturate instead of flipping
+    // sign: the input is made signed first (v ^ 0x80 is v - 128), then the
+    // rest of the offset, di - 1, is subtracted with saturation
+    const __m128i zero = _mm_setzero_si128(), even = _mm_set1_epi16(0x00ff);
+    const __m128i flip = _mm_set1_epi8((char) 0x80);
+    const __m128i bias = _mm_set1_epi16((int16_t) (((dq - 1) & 0xff) << 8 | ((di - 1) & 0xff)));
+    __m128i acc_i = zero, acc_q = zero;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (iq + i * 2));
+
+        acc_i = _mm_add_epi64(acc_i, _mm_sad_epu8(_mm_and_si128(v, even), zero));
+        acc_q = _mm_add_epi64(acc_q, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+        _mm_storeu_si128((__m128i *) (out + i * 2), _mm_subs_epi8(_mm_xor_si128(v, flip), bias));
+    }
+    si = sum64(acc_i);
+    sq = sum64(acc_q);
+#endif
+    for (; i < n; i++) {
+        si += iq[i * 2];
+        sq += iq[i * 2 + 1];
+        out[i * 2] = clampInt(iq[i * 2] - 127 - di, -128, 127);
+        out[i * 2 + 1] = clampInt(iq[i * 2 + 1] - 127 - dq, -128, 127);
+    }
+    sum[0] += si - 127.0 * n;
+    sum[1] += sq - 127.0 * n;
+}
+
+static void blockCS8(const void *in, int8_t *out, size_t n, const struct converter_state *state, double sum[2]) {
+    const int8_t *iq = in;
+    int di = offsetOf(state, 0, 1, 127), dq = offsetOf(state, 1, 1, 127);
+    int64_t si = 0, sq = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Sums of absolute differences only take unsigned bytes: add 128
+    const __m128i zero = _mm_setzero_si128(), even = _mm_set1_epi16(0x00ff);
+    const __m128i flip = _mm_set1_epi8((char) 0x80);
+    const __m128i bias = _mm_set1_epi16((int16_t) ((dq & 0xff) << 8 | (di & 0xff)));
+    __m128i acc_i = zero, acc_q = zero;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (iq + i * 2));
+        __m128i u = _mm_xor_si128(v, flip);
+
+        acc_i = _mm_add_epi64(acc_i, _mm_sad_epu8(_mm_and_si128(u, even), zero));
+        acc_q = _mm_add_epi64(acc_q, _mm_sad_epu8(_mm_srli_epi16(u, 8), zero));
+        _mm_storeu_si128((__m128i *) (out + i * 2), _mm_subs_epi8(v, bias));
+    }
+    si = sum64(acc_i) - 128 * (int64_t) i;
+    sq = sum64(acc_q) - 128 * (int64_t) i;
+#endif
+    for (; i < n; i++) {
+        si += iq[i * 2];
+        sq += iq[i * 2 + 1];
+        out[i * 2] = clampInt(iq[i * 2] - di, -128, 127);
+        out[i * 2 + 1] = clampInt(iq[i * 2 + 1] - dq, -128, 127);
+    }
+    sum[0] += si;
+    sum[1] += sq;
+}
+
+static void blockCS16(const void *in, int8_t *out, size_t n, const struct converter_state *state, double sum[2]) {
+    const int16_t *iq = in;
+    int di = offsetOf(state, 0, 256, 32767), dq = offsetOf(state, 1, 256, 32767);
+    int64_t si = 0, sq = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Rounded to the nearest of 256 steps, saturated in 16 then 8 bits
+    const __m128i bias = _mm_set1_epi32((int32_t) ((uint32_t) (dq & 0xffff) << 16 | (di & 0xffff)));
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i pick_i = _mm_set1_epi32(1), pick_q = _mm_set1_epi32(1 << 16);
+    __m128i acc_i = _mm_setzero_si128(), acc_q = _mm_setzero_si128();
+    int32_t lanes[4];
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (iq + i * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *) (iq + i * 2 + 8));
+
+        acc_i = _mm_add_epi32(acc_i, _mm_add_epi32(_mm_madd_epi16(a, pick_i), _mm_madd_epi16(b, pick_i)));
+        acc_q = _mm_add_epi32(acc_q, _mm_add_epi32(_mm_madd_epi16(a, pick_q), _mm_madd_epi16(b, pick_q)));
+        a = _mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(a, bias), half), 8);
+        b = _mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(b, bias), half), 8);
+        _mm_storeu_si128((__m128i *) (out + i * 2), _mm_packs_epi16(a, b));
+    }
+    _mm_storeu_si128((__m128i *) lanes, acc_i);
+    si = (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i *) lanes, acc_q);
+    sq = (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        si += iq[i * 2];
+        sq += iq[i * 2 + 1];
+        out[i * 2] = clampInt((clampInt(iq[i * 2] - di, -32768, 32767) + 128) >> 8, -128, 127);
+        out[i * 2 + 1] = clampInt((clampInt(iq[i * 2 + 1] - dq, -32768, 32767) + 128) >> 8, -128, 127);
+    }
+    sum[0] += si / 256.0;
+    sum[1] += sq / 256.0;
+}
+
+static void blockCF32(const void *in, int8_t *out, size_t n, const struct converter_state *state, double sum[2]) {
+    const float *iq = in;
+    float di = state->filter_dc ? state->dc[0] : 0, dq = state->filter_dc ? state->dc[1] : 0;
+    double si = 0, sq = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Rounded to nearest, saturated in 16 then 8 bits
+    const __m128 scale = _mm_set1_ps(127), bias = _mm_setr_ps(di, dq, di, dq);
+    __m128 acc = _mm_setzero_ps();
+    float lanes[4];
+
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_loadu_ps(iq + i * 2), b = _mm_loadu_ps(iq + i * 2 + 4);
+        __m128 c = _mm_loadu_ps(iq + i * 2 + 8), d = _mm_loadu_ps(iq + i * 2 + 12);
+        __m128i ab, cd;
+
+        acc = _mm_add_ps(acc, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+        ab = _mm_packs_epi32(_mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(a, scale), bias)),
+                             _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(b, scale), bias)));
+        cd = _mm_packs_epi32(_mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(c, scale), bias)),
+                             _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(d, scale), bias)));
+        _mm_storeu_si128((__m128i *) (out + i * 2), _mm_packs_epi16(ab, cd));
+    }
+    _mm_storeu_ps(lanes, acc);
+    si = (double) lanes[0] + lanes[2];
+    sq = (double) lanes[1] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        si += iq[i * 2];
+        sq += iq[i * 2 + 1];
+        out[i * 2] = clampInt(lrintf(iq[i * 2] * 127 - di), -128, 127);
+        out[i * 2 + 1] = clampInt(lrintf(iq[i * 2 + 1] * 127 - dq), -128, 127);
+    }
+    sum[0] += si * 127;
+    sum[1] += sq * 127;
+}
+
+static void convertBlocks(const void *in, int8_t *out, size_t n, struct converter_state *state, block_fn block, unsigned bytes) {
+    const uint8_t *iq = in;
+    size_t len;
+    int q;
+
+    while (n) {
+        double sum[2] = { 0, 0 }, alpha;
+
+        len = n < CONVERT_BLOCK ? n : CONVERT_BLOCK;
+        block(iq, out, len, state, sum);
+
+        if (state->filter_dc) {
+            alpha = state->primed ? 1 - exp(-state->dc_rate * len) : 1;
+            for (q = 0; q < 2; q++)
+                state->dc[q] += alpha * (sum[q] / len - state->dc[q]);
+            state->primed = 1;
+        }
+
+        iq += len * bytes;
+        out += len * 2;
+        n -= len;
+    }
+}
+
+static void convertCU8(const void *in, int8_t *out, size_t n, struct converter_state *state) {
+    convertBlocks(in, out, n, state, blockCU8, 2);
+}
+
+static void convertCS8(const void *in, int8_t *out, size_t n, struct converter_state *state) {
+    convertBlocks(in, out, n, state, blockCS8, 2);
+}
+
+static void convertCS16(const void *in, int8_t *out, size_t n, struct converter_state *state) {
+    convertBlocks(in, out, n, state, blockCS16, 4);
+}
+
+static void convertCF32(const void *in, int8_t *out, size_t n, struct converter_state *state) {
+    convertBlocks(in, out, n, state, blockCF32, 8);
+}
+
+int input_format_parse(const char *name, input_format_t *format) {
+    unsigned f;
+
+    for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        if (!strcasecmp(name, formats[f].name)) {
+            *format = f;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+unsigned input_format_bytes(input_format_t format) {
+    return formats[format].bytes;
+}
+
+iq_convert_fn init_converter(input_format_t format, double sample_rate, int filter_dc, struct converter_state **state) {
+    static const iq_convert_fn converters[] = {
+        [INPUT_CU8]  = convertCU8,
+        [INPUT_CS8]  = convertCS8,
+        [INPUT_CS16] = convertCS16,
+        [INPUT_CF32] = convertCF32,
+    };
+
+    if (!(*state = calloc(1, sizeof(**state))))
+        return NULL;
+    (*state)->filter_dc = filter_dc;
+    (*state)->dc_rate = 2 * M_PI * DC_CUTOFF / sample_rate;
+    return converters[format];
+}
+
+void reset_converter(struct converter_state *state) {
+    state->primed = 0;
+    state->dc[0] = state->dc[1] = 0;
+}
+
+void cleanup_converter(struct converter_state *state) {
+    free(state);
+}
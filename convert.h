@@ -0,0 +1,58 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// convert.h: input sample formats, converted to the signed 8-bit I/Q pairs
+// the decoder takes.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of the I/Q pairs read from the input. Full scale of the wider
+// formats maps to full scale of the 8-bit output.
+typedef enum {
+    INPUT_CU8,      // Unsigned 8-bit, 127 is zero (rtl_sdr)
+    INPUT_CS8,      // Signed 8-bit (hackrf_transfer)
+    INPUT_CS16,     // Signed 16-bit, little endian (airspy_rx, SoapySDR)
+    INPUT_CF32      // 32-bit float, -1 to 1 (GNU Radio, SDR++)
+} input_format_t;
+
+struct converter_state;
+
+// Convert n I/Q pairs to signed 8-bit ones. For the 8-bit formats, 'in' and
+// 'out' may be the same buffer.
+typedef void (*iq_convert_fn)(const void *in, int8_t *out, size_t n, struct converter_state *state);
+
+// The format called 'name' (cu8, cs8, cs16 or cf32). Returns -1 if there is
+// no such format.
+int input_format_parse(const char *name, input_format_t *format);
+
+// Bytes per I/Q pair
+unsigned input_format_bytes(input_format_t format);
+
+// The converter from 'format', and its state in *state. With filter_dc, the
+// DC offset of the input is tracked, and taken out in the same pass. Returns
+// NULL if we are out of memory.
+iq_convert_fn init_converter(input_format_t format, double sample_rate, int filter_dc, struct converter_state **state);
+
+// Forget the DC offset, for input that does not follow on from the last
+// samples converted
+void reset_converter(struct converter_state *state);
+
+void cleanup_converter(struct converter_state *state);
+
+#endif
@@ -0,0 +1,114 @@
+/* crc_bench, CRC-CCITT microbenchmark on FLARM-sized frames
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times update_crc_ccitt() byte after byte against each implementation of
+// crc_ccitt(), after checking that they all agree. Build with "make
+// crc_bench". lib_crc.c is included rather than linked, to reach the
+// implementations that crc_ccitt() picks from.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lib_crc.c"
+
+#define FRAME_BYTES 29          // FLARM frame, CRC included
+#define FRAMES      4096        // Frames cycled through, so that they stay in L1
+#define ROUNDS      2000
+
+static unsigned char frames[FRAMES][FRAME_BYTES];
+
+static unsigned short bytewise(unsigned short crc, const unsigned char *buf, size_t len) {
+    while (len--)
+        crc = update_crc_ccitt(crc, *buf++);
+    return crc;
+}
+
+static const struct {
+    const char *name;
+    crc_ccitt_fn fn;
+} impls[] = {
+    { "update_crc_ccitt", bytewise },
+    { "slice-by-8", crc_ccitt_slice8 },
+#ifdef CRC_CLMUL
+    { "clmul", crc_ccitt_clmul },
+#endif
+    { "crc_ccitt", crc_ccitt },
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    volatile unsigned short sink = 0;
+    unsigned short crc, expected;
+    unsigned i, f, r, n, len;
+    double start, elapsed, best;
+    int clmul = 0;
+
+#ifdef CRC_CLMUL
+    __builtin_cpu_init();
+    clmul = __builtin_cpu_supports("pclmul");
+#endif
+
+    srand(1);
+    for (f = 0; f < FRAMES; f++)
+        for (i = 0; i < FRAME_BYTES; i++)
+            frames[f][i] = rand();
+
+    // Every length up to a frame, and the check value of lib_crc.txt
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (!clmul && !strcmp(impls[i].name, "clmul"))
+            continue;
+        if (impls[i].fn(0xffff, (const unsigned char *) "123456789", 9) != 0x29B1) {
+            fprintf(stderr, "%s: wrong check value\n", impls[i].name);
+            return 1;
+        }
+        for (f = 0; f < 256; f++) {
+            for (len = 0; len <= FRAME_BYTES; len++) {
+                expected = bytewise(f * 257, frames[f], len);
+                if (impls[i].fn(f * 257, frames[f], len) != expected) {
+                    fprintf(stderr, "%s: wrong CRC over %u bytes\n", impls[i].name, len);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    printf("%d-byte frames, ns per frame (best of 5):\n", FRAME_BYTES);
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (!clmul && !strcmp(impls[i].name, "clmul"))
+            continue;
+        for (r = 0, best = 1e9; r < 5; r++) {
+            start = now();
+            for (n = 0; n < ROUNDS; n++) {
+                for (f = 0, crc = 0xffff; f < FRAMES; f++)
+                    crc ^= impls[i].fn(0xffff, frames[f], FRAME_BYTES);
+                sink ^= crc;
+            }
+            elapsed = now() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+        printf("  %-18s %6.1f\n", impls[i].name, best * 1e9 / ROUNDS / FRAMES);
+    }
+    return 0;
+}
@@ -1,28 +1,54 @@
 //
 // Created by Giorgio Tresoldi on 03.04.17.
 //
+#define _GNU_SOURCE   // For pthread_setaffinity_np()
 #include<stdio.h>
 #include<string.h>    //strlen
 #include<sys/socket.h>
 #include<arpa/inet.h> //inet_addr
 #include<unistd.h>    //write
 #include<pthread.h>
+#include<sys/mman.h>
+#include<stdbool.h>
 
 #include "dump868.h"
-#include "nrf905_demod.c"
+#include "libdump868.h"
 #include "net_io.h"
 #include "util.h"
 
+struct _DumpFLARM DumpFLARM;
 
-/* Run Periodic network functions every 5 seconds */
-void *threadproc(void *arg)
-{
-    while(true)
-    {
-        modesNetPeriodicWork();
-        sleep(5);
-    }
-    return 0;
+/* Settings for every decoder we create */
+static struct dump868_options decoder_options;
+
+/* Decoder fed by the streaming (live or --ifile) input */
+static struct dump868_decoder *decoder;
+
+/* Sample index to the 12MHz clock of the Beast timestamps, without
+ * overflowing for centuries
+ */
+static uint64_t sampleClock(uint64_t index) {
+    return index / DumpFLARM.clock_div * DumpFLARM.clock_mul +
+           index % DumpFLARM.clock_div * DumpFLARM.clock_mul / DumpFLARM.clock_div;
+}
+
+static void sigintHandler(int dummy) {
+    MODES_NOTUSED(dummy);
+    signal(SIGINT, SIG_DFL);  // reset signal handler - bit extra safety
+    DumpFLARM.exit = 1;       // Signal to threads that we are done
+}
+
+/* Wait on 'cond' for at most MODES_EXIT_POLL_MS. Signalling a condition
+ * variable is not async-signal-safe, so sigintHandler() can only set
+ * DumpFLARM.exit, and whoever waits on it has to look again now and then.
+ */
+static void exitWait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += MODES_EXIT_POLL_MS * 1000000L;
+    normalize_timespec(&ts);
+    pthread_cond_timedwait(cond, mutex, &ts);
 }
 
 
@@ -36,6 +62,26 @@ void showHelp(void) {
                     "--ppm <error>            Set receiver error in parts per million (default 0)\n"
                     "--enable-rtlsdr-biast    Set bias tee supply on (default off)\n"
                     "--net-port <ports>       TCP Beast output listen ports (default: 30006)\n"
+                    "--ifile <filename>       Read samples from file instead of rtl_sdr\n"
+                    "--rtltcp <host[:port]>   Read samples from an rtl_tcp server instead of rtl_sdr (default port: 1234)\n"
+                    "--iformat <format>       Sample format of --ifile: cu8, cs8, cs16 or cf32 (default: cu8)\n"
+                    "--dcfilter               Remove the DC offset of the input\n"
+                    "--throttle               When reading from a file, play back in realtime, not at max speed\n"
+                    "--raw                    Print the hex values of decoded messages on stdout\n"
+                    "--workers <n>            Decode --ifile offline in parallel chunks on <n> threads\n"
+                    "--dft-engine <name>      Sliding DFT implementation: auto, scalar, sse2, avx2, int (default: auto)\n"
+                    "--preamble-errors <n>    Accept preambles with up to <n> wrong symbols, 0-4 (default: 0)\n"
+                    "--symbol-sync            Look for messages once per symbol at the recovered timing (less CPU)\n"
+                    "--squelch <db>           Only look for messages this far above the noise floor, 0 for everywhere (default: 4)\n"
+                    "--channels <list>        Comma separated channels to decode, in MHz, or 'all' (default: 868.2,868.4)\n"
+                    "--sample-rate <MS/s>     Input sample rate, 3.2 or 6.4 to decode channels further apart,\n"
+                    "                         others (like 2.048 or 2.4) are resampled to 1.6 (default: 1.6)\n"
+                    "--slicer-threads <n>     Look for messages on <n> threads, each with a share of the channels (default: 0)\n"
+                    "--cpu-affinity <list>    Comma separated CPUs to pin the demodulator thread, then each slicer thread to\n"
+                    "--decode-threads <n>     Decode candidate messages on <n> threads, may reorder them (default: 0)\n"
+                    "--fix-crc <n>            Correct up to <n> wrong bits of messages with a bad CRC, 0-2 (default: 0)\n"
+                    "--net-no-corrected       Do not send messages with corrected bits to the network outputs\n"
+                    "--no-combine             Do not combine resends of messages that fail on their own\n"
 
 
     );
@@ -68,91 +114,1049 @@ void modesInitConfig(void) {
     DumpFLARM.json_interval           = 1000;
     DumpFLARM.json_location_accuracy  = 1;
     DumpFLARM.maxRange                = 1852 * 300; // 300NM default max range
+
+    dump868_default_options(&decoder_options);
+    decoder_options.squelch_db = MODES_MSG_SQUELCH_DB;
+    DumpFLARM.sample_rate = decoder_options.input_rate;
+    DumpFLARM.demod_cpu = -1;
 }
 
 
-/* Subroutine: main()
- * Description: get chunks of data from STDIN and forward to sliding_dft()
+//
+// =============================== Sample input ===========================
+//
+void modesInitBuffers(void) {
+    int i;
+
+    pthread_mutex_init(&DumpFLARM.data_mutex, NULL);
+    pthread_cond_init(&DumpFLARM.data_cond, NULL);
+
+    /* Preallocate the whole ring up front, so that the reader never has to
+     * wait on the allocator. Blocks are page aligned; the reader fills them
+     * with large reads straight from the input.
+     */
+    for (i = 0; i < MODES_MAG_BUFFERS; i++) {
+        void *data;
+
+        if (posix_memalign(&data, 4096, MODES_MAG_BUF_SAMPLES * 2) != 0) {
+            fprintf(stderr, "Out of memory allocating sample buffers.\n");
+            exit(1);
+        }
+
+        DumpFLARM.mag_buffers[i].data = data;
+        DumpFLARM.mag_buffers[i].length = 0;
+        DumpFLARM.mag_buffers[i].dropped = 0;
+    }
+
+    DumpFLARM.first_free_buffer = 0;
+    DumpFLARM.first_filled_buffer = 0;
+}
+
+/* Timestamp a block that has just been filled with the samples from 'index'
+ * on: the 12MHz clock from the sample count, and the system time, once per
+ * block, back-dated to its first sample.
+ */
+static void readerStamp(struct mag_buf *buf, uint64_t index, size_t len) {
+    clock_gettime(CLOCK_REALTIME, &buf->sysTimestamp);
+    buf->sysTimestamp.tv_nsec -= (long) (len * 1e9 / DumpFLARM.sample_rate);
+    normalize_timespec(&buf->sysTimestamp);
+    buf->sampleTimestamp = sampleClock(index);
+}
+
+/* Hand the block at first_free_buffer over to the demodulator */
+static void readerPublish(unsigned next_free_buffer) {
+    pthread_mutex_lock(&DumpFLARM.data_mutex);
+    DumpFLARM.first_free_buffer = next_free_buffer;
+    pthread_cond_signal(&DumpFLARM.data_cond);
+    pthread_mutex_unlock(&DumpFLARM.data_mutex);
+}
+
+/* End of input: let the demodulator drain what is already queued, then tell
+ * everyone to shut down. Samples dropped since the last delivered block have
+ * no block to travel with, account for them here.
+ */
+static void readerFinish(uint64_t dropped) {
+    pthread_mutex_lock(&DumpFLARM.data_mutex);
+    while (!DumpFLARM.exit && DumpFLARM.first_filled_buffer != DumpFLARM.first_free_buffer)
+        exitWait(&DumpFLARM.data_cond, &DumpFLARM.data_mutex);
+    DumpFLARM.stats_samples_dropped += dropped;
+    DumpFLARM.exit = 1;
+    pthread_cond_signal(&DumpFLARM.data_cond);
+    pthread_mutex_unlock(&DumpFLARM.data_mutex);
+}
+
+/* The block at first_free_buffer to read live samples into, or NULL if the
+ * ring is full and they have to be discarded. Once the ring has overflowed,
+ * wait until it is half empty again before delivering, rather than flapping
+ * on every block.
+ */
+static struct mag_buf *readerNextBlock(int *dropping, unsigned *next_free_buffer) {
+    unsigned free_bufs;
+    struct mag_buf *outbuf;
+
+    pthread_mutex_lock(&DumpFLARM.data_mutex);
+    *next_free_buffer = (DumpFLARM.first_free_buffer + 1) % MODES_MAG_BUFFERS;
+    outbuf = &DumpFLARM.mag_buffers[DumpFLARM.first_free_buffer];
+    free_bufs = (DumpFLARM.first_filled_buffer - *next_free_buffer + MODES_MAG_BUFFERS) % MODES_MAG_BUFFERS;
+    pthread_mutex_unlock(&DumpFLARM.data_mutex);
+
+    *dropping = free_bufs == 0 || (*dropping && free_bufs < MODES_MAG_BUFFERS / 2);
+    return *dropping ? NULL : outbuf;
+}
+
+/* Subroutine: readerThreadEntryPoint()
+ * Description: producer side of the sample ring. Read whole blocks piped
+ *  from rtl_sdr and hand them to the demodulator thread. If the demodulator
+ *  falls behind and the ring is full, keep draining the pipe (otherwise
+ *  rtl_sdr drops samples behind our back) but discard the data and account
+ *  for it in the 'dropped' counter of the next block we do deliver.
  * Input:
- *  argc: argument counter
- *  argv: array of arguments
- * Output: exit code
+ *  arg: FILE pointer of the rtl_sdr pipe
+ * Output: none
  */
-int main(int argc, char **argv) {
-    int j;
-    uint16_t i;
-    size_t len;
-    uint8_t raw_buffer[buffer_size * 2]; // each I/Q sample has two bytes!
-    int8_t param;
+static void *readerThreadEntryPoint(void *arg) {
+    FILE *fp = arg;
+    int8_t *scratch;
+    uint64_t dropped = 0;
+    uint64_t index = 0;                     // Of the next sample read, dropped or not
+    int dropping = 0;
 
-    packet_bytes=29;
+    if (!(scratch = malloc(MODES_MAG_BUF_SAMPLES * 2))) {
+        fprintf(stderr, "Out of memory allocating reader buffer.\n");
+        exit(1);
+    }
 
-    modesInitConfig();
+    // Read directly into the ring blocks, no stdio staging copy
+    setvbuf(fp, NULL, _IONBF, 0);
 
+    while (!DumpFLARM.exit) {
+        struct mag_buf *outbuf;
+        unsigned next_free_buffer;
+        int8_t *dest;
+        size_t len;
 
-    for (j = 1; j < argc; j++) {
-        int more = j+1 < argc; // There are more arguments
+        outbuf = readerNextBlock(&dropping, &next_free_buffer);
+        dest = outbuf ? outbuf->data : scratch;
 
+        len = fread(dest, 1, MODES_MAG_BUF_SAMPLES * 2, fp) / 2;
+        if (len == 0)
+            break;
 
-        if (!strcmp(argv[j],"--device-index") && more) {
-            DumpFLARM.dev_name = strdup(argv[++j]);
-        } else if (!strcmp(argv[j],"--gain") && more) {
-            DumpFLARM.gain = (int) (atof(argv[++j])); 
-        } else if (!strcmp(argv[j],"--help")) {
-            showHelp();
-            exit(0);
-        } else if (!strcmp(argv[j],"--ppm") && more) {
-            DumpFLARM.ppm_error = atoi(argv[++j]);
-        } else if (!strcmp(argv[j], "--enable-rtlsdr-biast")) {
-            DumpFLARM.enable_rtlsdr_biast = 1;
-        } else if (!strcmp(argv[j],"--net-port") && more) {
-            free(DumpFLARM.net_output_beast_ports);
-            DumpFLARM.net_output_beast_ports = strdup(argv[++j]);
-        }else if (!strcmp(argv[j],"--other") && more) {
-            DumpFLARM.other_options = strdup(argv[++j]);
-        } else {
-            fprintf(stderr,
-                    "Unknown or not enough arguments for option '%s'.\n\n",
-                    argv[j]);
-            showHelp();
-            exit(1);
+        index += len;
+        if (dest == scratch) {
+            dropped += len;
+            continue;
         }
+
+        readerStamp(outbuf, index - len, len);
+
+        // The data comes in I/Q pairs, like: IQIQIQIQIQ...
+        DumpFLARM.converter_function(dest, dest, len, DumpFLARM.converter_state);
+
+        outbuf->length = len;
+        outbuf->dropped = dropped;
+        dropped = 0;
+
+        readerPublish(next_free_buffer);
     }
 
-    /*
-     * Networking
-     *
-     * */
+    readerFinish(dropped);
+    free(scratch);
+    return NULL;
+}
 
-    modesInitNet();
+/* rtl_tcp commands, see rtl_tcp.c in librtlsdr. Each is the command byte
+ * and a 32-bit big endian parameter.
+ */
+#define RTLTCP_SET_FREQ             0x01
+#define RTLTCP_SET_SAMPLE_RATE      0x02
+#define RTLTCP_SET_GAIN_MODE        0x03
+#define RTLTCP_SET_GAIN             0x04
+#define RTLTCP_SET_FREQ_CORRECTION  0x05
+#define RTLTCP_SET_GAIN_BY_INDEX    0x0d
+#define RTLTCP_SET_BIAS_TEE         0x0e
+
+static const char *rtltcp_tuners[] = { "unknown", "E4000", "FC0012", "FC0013", "FC2580", "R820T", "R828D" };
+
+/* Read 'len' bytes from the rtl_tcp socket, or as many as there are until it
+ * is closed (errno 0), fails or times out (errno set). Returns the bytes read.
+ */
+static size_t rtltcpRead(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len) {
+        n = read(fd, (char *) buf + got, len - got);
+        if (n > 0) {
+            got += n;
+        } else if (n == 0) {
+            errno = 0;
+            break;
+        } else if (errno != EINTR) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                errno = ETIMEDOUT;
+            break;
+        }
+    }
+    return got;
+}
+
+static int rtltcpCommand(int fd, uint8_t command, uint32_t param) {
+    unsigned char buf[5] = { command, param >> 24, param >> 16, param >> 8, param };
+
+    return anetWrite(fd, (char *) buf, sizeof(buf)) == sizeof(buf) ? 0 : -1;
+}
+
+/* Subroutine: rtltcpHandshake()
+ * Description: check the header rtl_tcp greets us with, then tune the
+ *  dongle the way modesInitRtlsdr() asks rtl_sdr to
+ * Input:
+ *  fd: freshly connected socket
+ *  err: where to describe what went wrong
+ * Output: 0, or -1 on error
+ */
+static int rtltcpHandshake(int fd, char *err) {
+    struct timeval timeout = { MODES_RTLTCP_TIMEOUT, 0 };
+    unsigned char header[12];
+    uint32_t tuner, gains;
+    int rcvbuf;
+    socklen_t optlen = sizeof(rcvbuf);
+    static int warned;
+    int ok;
 
-    /* Create Thread for periodic net operations */
-    pthread_t tid;
-    pthread_create(&tid, NULL, &threadproc, NULL);
+    // A server that stops sending should not hang us, reconnect instead
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        snprintf(err, ANET_ERR_LEN, "setsockopt SO_RCVTIMEO: %s", strerror(errno));
+        return -1;
+    }
+
+    if (rtltcpRead(fd, header, sizeof(header)) != sizeof(header)) {
+        snprintf(err, ANET_ERR_LEN, "no header: %s", errno ? strerror(errno) : "closed by the server");
+        return -1;
+    }
+    if (memcmp(header, "RTL0", 4)) {
+        snprintf(err, ANET_ERR_LEN, "not an rtl_tcp server");
+        return -1;
+    }
+    tuner = (uint32_t) header[4] << 24 | header[5] << 16 | header[6] << 8 | header[7];
+    gains = (uint32_t) header[8] << 24 | header[9] << 16 | header[10] << 8 | header[11];
+
+    ok = rtltcpCommand(fd, RTLTCP_SET_SAMPLE_RATE, decoder_options.input_rate) == 0 &&
+         rtltcpCommand(fd, RTLTCP_SET_FREQ, MODES_FLARM_FREQ) == 0 &&
+         rtltcpCommand(fd, RTLTCP_SET_FREQ_CORRECTION, (uint32_t) DumpFLARM.ppm_error) == 0 &&
+         rtltcpCommand(fd, RTLTCP_SET_BIAS_TEE, DumpFLARM.enable_rtlsdr_biast) == 0;
+
+    // Like rtl_sdr: automatic gain unless one is given, the highest the tuner has for MODES_MAX_GAIN
+    if (DumpFLARM.gain <= 0)
+        ok = ok && rtltcpCommand(fd, RTLTCP_SET_GAIN_MODE, 0) == 0;
+    else if (DumpFLARM.gain >= MODES_MAX_GAIN && gains > 0)
+        ok = ok && rtltcpCommand(fd, RTLTCP_SET_GAIN_MODE, 1) == 0 &&
+             rtltcpCommand(fd, RTLTCP_SET_GAIN_BY_INDEX, gains - 1) == 0;
+    else
+        ok = ok && rtltcpCommand(fd, RTLTCP_SET_GAIN_MODE, 1) == 0 &&
+             rtltcpCommand(fd, RTLTCP_SET_GAIN, DumpFLARM.gain * 10) == 0;
+
+    if (!ok) {
+        snprintf(err, ANET_ERR_LEN, "sending commands: %s", strerror(errno));
+        return -1;
+    }
+
+    // Linux reports twice the size granted, the other half is for its bookkeeping
+    if (!warned && getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) == 0 && rcvbuf / 2 < MODES_RTLTCP_RCVBUF) {
+        fprintf(stderr, "rtl_tcp receive buffer is %d bytes, not %d: raise net.core.rmem_max to ride out network stalls.\n",
+                rcvbuf / 2, MODES_RTLTCP_RCVBUF);
+        warned = 1;
+    }
+
+    fprintf(stderr, "Connected to rtl_tcp at %s:%s, %s tuner\n", DumpFLARM.rtltcp_host, DumpFLARM.rtltcp_port,
+            tuner < sizeof(rtltcp_tuners) / sizeof(rtltcp_tuners[0]) ? rtltcp_tuners[tuner] : "unknown");
+    return 0;
+}
+
+/* Subroutine: rtltcpConnect()
+ * Description: connect to the rtl_tcp server and tune it, trying again
+ *  with a growing delay until it works or we are told to exit. The first
+ *  samples, still tuned the way the server was before our commands, are
+ *  discarded.
+ * Input: none
+ * Output: socket to read the samples from, or -1 on exit
+ */
+static int rtltcpConnect(void) {
+    char err[ANET_ERR_LEN];
+    unsigned delay = 1, waited;
+    size_t settle = (size_t) DumpFLARM.sample_rate * MODES_RTLTCP_SETTLE_MS / 1000 * 2;
+    int8_t discard[4096];
+    int fd;
+
+    while (!DumpFLARM.exit) {
+        fd = anetTcpConnectRecvBuffer(err, DumpFLARM.rtltcp_host, DumpFLARM.rtltcp_port, MODES_RTLTCP_RCVBUF);
+        if (fd >= 0 && rtltcpHandshake(fd, err) == 0) {
+            size_t left = settle, chunk;
+
+            while (left > 0) {
+                chunk = left < sizeof(discard) ? left : sizeof(discard);
+                if (rtltcpRead(fd, discard, chunk) != chunk)
+                    break;
+                left -= chunk;
+            }
+            if (left == 0)
+                return fd;
+            snprintf(err, ANET_ERR_LEN, "%s", errno ? strerror(errno) : "closed by the server");
+        }
+        if (fd >= 0)
+            close(fd);
+
+        fprintf(stderr, "rtl_tcp at %s:%s: %s, trying again in %u s\n",
+                DumpFLARM.rtltcp_host, DumpFLARM.rtltcp_port, err, delay);
+        for (waited = 0; waited < delay * 10 && !DumpFLARM.exit; waited++)
+            usleep(100000);
+        if (delay < MODES_RTLTCP_MAX_RETRY)
+            delay *= 2;
+    }
+    return -1;
+}
+
+/* Samples the stream has lost, going by the wall clock: how far 'index'
+ * trails the samples the sample rate says we should have by now, since the
+ * stream was last on time. Delays up to 'slack' are taken as network jitter.
+ * The dongle crystal is tens of ppm off, so a stream that is late but within
+ * the slack also moves the anchor a bit towards it: a steady drift is
+ * followed, and only a sudden jump, a stall, counts as lost.
+ */
+static uint64_t rtltcpLost(struct timespec *on_time, uint64_t *on_time_index, uint64_t index, uint64_t slack) {
+    struct timespec now;
+    uint64_t expected;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    expected = *on_time_index + (uint64_t) (((now.tv_sec - on_time->tv_sec) +
+                                             (now.tv_nsec - on_time->tv_nsec) / 1e9) * DumpFLARM.sample_rate);
+    if (index + slack >= expected) {
+        *on_time = now;
+        *on_time_index = index >= expected ? index : expected - (expected - index) / MODES_RTLTCP_DRIFT_BLOCKS;
+        return 0;
+    }
+
+    *on_time = now;
+    *on_time_index = expected;
+    return expected - index;
+}
+
+/* Subroutine: rtltcpReaderThreadEntryPoint()
+ * Description: producer side of the sample ring for --rtltcp. Like
+ *  readerThreadEntryPoint(), but the samples come from an rtl_tcp server,
+ *  which we reconnect to whenever the connection drops. rtl_tcp has no
+ *  sequence numbers, so lost samples are found with the wall clock: the
+ *  time spent reconnecting, and the server falling behind (its own buffers
+ *  overflowing, or USB drops on its side), skip the sample index ahead and
+ *  count as dropped.
+ * Input:
+ *  arg: unused
+ * Output: none
+ */
+static void *rtltcpReaderThreadEntryPoint(void *arg) {
+    int8_t *scratch;
+    uint64_t dropped = 0, lost;
+    uint64_t index = 0;                     // Of the next sample read, dropped or not
+    uint64_t on_time_index = 0;
+    uint64_t slack = (uint64_t) DumpFLARM.sample_rate * MODES_RTLTCP_MAX_LAG_MS / 1000;
+    struct timespec on_time;
+    int dropping = 0, fd = -1, timed = 0, rebase = 0;
+
+    MODES_NOTUSED(arg);
+
+    if (!(scratch = malloc(MODES_MAG_BUF_SAMPLES * 2))) {
+        fprintf(stderr, "Out of memory allocating reader buffer.\n");
+        exit(1);
+    }
+
+    while (!DumpFLARM.exit) {
+        struct mag_buf *outbuf;
+        unsigned next_free_buffer;
+        int8_t *dest;
+        size_t got, len;
+
+        if (fd < 0) {
+            if ((fd = rtltcpConnect()) < 0)
+                break;
+
+            // All of the time since the last samples was lost
+            if (timed && (lost = rtltcpLost(&on_time, &on_time_index, index, 0)) > 0) {
+                index += lost;
+                dropped += lost;
+            }
+            rebase = 1;
+        }
+
+        outbuf = readerNextBlock(&dropping, &next_free_buffer);
+        dest = outbuf ? outbuf->data : scratch;
+
+        got = rtltcpRead(fd, dest, MODES_MAG_BUF_SAMPLES * 2);
+        if (got < MODES_MAG_BUF_SAMPLES * 2) {
+            if (!DumpFLARM.exit)
+                fprintf(stderr, "rtl_tcp connection lost: %s\n", errno ? strerror(errno) : "closed by the server");
+            close(fd);
+            fd = -1;
+        }
+
+        len = got / 2;
+        if (len == 0)
+            continue;
+
+        /* Time the stream from the first whole block of each connection,
+         * whatever the network latency. A block cut short by a lost
+         * connection was late for that reason, reconnecting accounts for it.
+         */
+        if (fd >= 0 && rebase) {
+            clock_gettime(CLOCK_MONOTONIC, &on_time);
+            on_time_index = index + len;
+            timed = 1;
+            rebase = 0;
+        } else if (fd >= 0 && (lost = rtltcpLost(&on_time, &on_time_index, index + len, slack)) > 0) {
+            fprintf(stderr, "rtl_tcp stream %.1f s behind, skipping ahead\n", lost / DumpFLARM.sample_rate);
+            index += lost;
+            dropped += lost;
+        }
+
+        index += len;
+        if (dest == scratch) {
+            dropped += len;
+            continue;
+        }
+
+        readerStamp(outbuf, index - len, len);
+
+        // The data comes in I/Q pairs, like: IQIQIQIQIQ...
+        DumpFLARM.converter_function(dest, dest, len, DumpFLARM.converter_state);
+
+        outbuf->length = len;
+        outbuf->dropped = dropped;
+        dropped = 0;
+
+        readerPublish(next_free_buffer);
+    }
+
+    if (fd >= 0)
+        close(fd);
+    readerFinish(dropped);
+    free(scratch);
+    return NULL;
+}
+
+/* Subroutine: fileReaderThreadEntryPoint()
+ * Description: producer side of the sample ring for --ifile. The capture is
+ *  memory-mapped, so a block is filled by converting straight out of the
+ *  page cache. Unlike live input, nothing is ever dropped: when the ring is
+ *  full we simply wait for the demodulator. With --throttle, blocks are
+ *  released at the real sample rate instead of as fast as possible.
+ * Input:
+ *  arg: unused
+ * Output: none
+ */
+static void *fileReaderThreadEntryPoint(void *arg) {
+    size_t offset = 0, bytes = input_format_bytes(DumpFLARM.input_format);
+    struct timespec next_buffer_delivery;
+
+    MODES_NOTUSED(arg);
+
+    clock_gettime(CLOCK_MONOTONIC, &next_buffer_delivery);
+
+    while (!DumpFLARM.exit && DumpFLARM.ifile_size - offset >= bytes) {
+        struct mag_buf *outbuf;
+        unsigned next_free_buffer;
+        size_t len;
+
+        pthread_mutex_lock(&DumpFLARM.data_mutex);
+        next_free_buffer = (DumpFLARM.first_free_buffer + 1) % MODES_MAG_BUFFERS;
+        while (!DumpFLARM.exit && next_free_buffer == DumpFLARM.first_filled_buffer)
+            exitWait(&DumpFLARM.data_cond, &DumpFLARM.data_mutex);
+        outbuf = &DumpFLARM.mag_buffers[DumpFLARM.first_free_buffer];
+        pthread_mutex_unlock(&DumpFLARM.data_mutex);
+
+        if (DumpFLARM.exit)
+            break;
+
+        len = (DumpFLARM.ifile_size - offset) / bytes;
+        if (len > MODES_MAG_BUF_SAMPLES)
+            len = MODES_MAG_BUF_SAMPLES;
+
+        DumpFLARM.converter_function(DumpFLARM.ifile_data + offset, outbuf->data, len, DumpFLARM.converter_state);
+        offset += len * bytes;
+
+        outbuf->length = len;
+        outbuf->dropped = 0;
+
+        if (DumpFLARM.throttle) {
+            // Wait until we are allowed to release this buffer to the main thread
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_buffer_delivery, NULL) == EINTR)
+                ;
+
+            // compute the time we can deliver the next buffer.
+            next_buffer_delivery.tv_nsec += len * 1e9 / DumpFLARM.sample_rate;
+            normalize_timespec(&next_buffer_delivery);
+        }
+
+        readerStamp(outbuf, offset / bytes - len, len);
+
+        readerPublish(next_free_buffer);
+    }
+
+    readerFinish(0);
+    return NULL;
+}
+
+/* Subroutine: modesInitFile()
+ * Description: map the --ifile capture and tell the kernel we'll stream it
+ *  front to back, so it reads ahead aggressively.
+ * Input: none
+ * Output: none
+ */
+static void modesInitFile(void) {
+    struct stat st;
+    void *map;
+
+    if ((DumpFLARM.fd = open(DumpFLARM.filename, O_RDONLY)) < 0) {
+        perror("Opening data file");
+        exit(1);
+    }
+
+    if (fstat(DumpFLARM.fd, &st) < 0) {
+        perror("Reading data file size");
+        exit(1);
+    }
+
+    DumpFLARM.ifile_size = st.st_size;
+    if (DumpFLARM.ifile_size < input_format_bytes(DumpFLARM.input_format)) {
+        fprintf(stderr, "Data file %s is empty.\n", DumpFLARM.filename);
+        exit(1);
+    }
+
+    map = mmap(NULL, DumpFLARM.ifile_size, PROT_READ, MAP_SHARED, DumpFLARM.fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Mapping data file");
+        exit(1);
+    }
+
+    posix_fadvise(DumpFLARM.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    madvise(map, DumpFLARM.ifile_size, MADV_SEQUENTIAL);
+
+    DumpFLARM.ifile_data = map;
+}
+
+//
+// =============================== Packet output ===========================
+//
+/* Subroutine: output_frame()
+ * Description: hand a decoded packet over to the output thread, in a frame
+ *  from the pool. Waits for one to be freed if they are all queued already.
+ *  The packet is timestamped from its sample index and the fraction of a
+ *  sample past it, the output thread works out the system time.
+ * Input:
+ *  opaque: unused, for compatibility with dump868_frame_fn
+ *  frame: the decoded packet
+ * Output: none
+ */
+static void output_frame(void *opaque, const struct dump868_frame *frame) {
+    struct flarmFrame *f;
+
+    MODES_NOTUSED(opaque);
+
+    pthread_mutex_lock(&DumpFLARM.frame_mutex);
+    while (!(f = DumpFLARM.frame_free))
+        pthread_cond_wait(&DumpFLARM.frame_cond, &DumpFLARM.frame_mutex);
+    DumpFLARM.frame_free = f->next;
+
+    f->next = NULL;
+    f->sampleIndex = frame->sample_index;
+    f->timestampMsg = sampleClock(frame->sample_index) +
+                      (uint64_t) llround(frame->sample_fraction * DumpFLARM.clock_mul / DumpFLARM.clock_div);
+    f->signalLevel = frame->rms / (128.0 * 128.0);
+    f->signalNoise = frame->snr_db;
+    f->score = frame->score;
+    f->msglen = frame->length;
+    f->channel = frame->channel;
+    f->correctedbits = frame->corrected_bits;
+    f->receptions = frame->receptions;
+    memcpy(f->msg, frame->data, frame->length);
+
+    *DumpFLARM.frame_queue_tail = f;
+    DumpFLARM.frame_queue_tail = &f->next;
+    pthread_cond_broadcast(&DumpFLARM.frame_cond);
+    pthread_mutex_unlock(&DumpFLARM.frame_mutex);
+}
+
+/* Subroutine: outputFrame()
+ * Description: print the decoded packet and send it to the network clients
+ * Input:
+ *  f: the frame, from the output queue
+ * Output: none
+ */
+static void outputFrame(struct flarmFrame *f) {
+    static const char hex[] = "0123456789abcdef";
+    char output[2 * MODES_LONG_MSG_BYTES + 4], *p = output;
+    unsigned i;
+
+    if (DumpFLARM.raw) {
+        *p++ = '*';
+        for (i = 0; i < f->msglen; i++) {
+            *p++ = hex[f->msg[i] >> 4];
+            *p++ = hex[f->msg[i] & 15];
+        }
+        *p++ = ';';
+        *p++ = '\n';
+        fwrite(output, 1, p - output, stdout);
+    }
+
+    modesQueueOutput(f);
+}
+
+/* Subroutine: outputThreadEntryPoint()
+ * Description: output the frames queued by output_frame(), in order, and
+ *  run the periodic network functions every 5 seconds, until output_exit
+ *  is set and the queue is empty
+ * Input:
+ *  arg: unused
+ * Output: NULL
+ */
+static void *outputThreadEntryPoint(void *arg) {
+    uint64_t next_periodic = 0;
+
+    MODES_NOTUSED(arg);
+
+    pthread_mutex_lock(&DumpFLARM.frame_mutex);
+    for (;;) {
+        struct flarmFrame *queue, **tail, *f;
+        uint64_t now = mstime(), anchor_clock;
+        struct timespec anchor_time;
+
+        if (now >= next_periodic) {
+            pthread_mutex_unlock(&DumpFLARM.frame_mutex);
+            modesNetPeriodicWork();
+            pthread_mutex_lock(&DumpFLARM.frame_mutex);
+            next_periodic = now + 5000;
+        }
+
+        if (!DumpFLARM.frame_queue) {
+            struct timespec ts;
+
+            if (DumpFLARM.output_exit)
+                break;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += (next_periodic - now) / 1000;
+            ts.tv_nsec += (next_periodic - now) % 1000 * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&DumpFLARM.frame_cond, &DumpFLARM.frame_mutex, &ts);
+            continue;
+        }
 
+        // Take the whole queue, so the decoder can keep adding to it meanwhile
+        queue = DumpFLARM.frame_queue;
+        tail = DumpFLARM.frame_queue_tail;
+        DumpFLARM.frame_queue = NULL;
+        DumpFLARM.frame_queue_tail = &DumpFLARM.frame_queue;
+        anchor_clock = DumpFLARM.anchor_clock;
+        anchor_time = DumpFLARM.anchor_time;
+        pthread_mutex_unlock(&DumpFLARM.frame_mutex);
 
+        for (f = queue; f; f = f->next) {
+            int64_t ns = receiveclock_ns_elapsed(anchor_clock, f->timestampMsg);
 
-    /* Pre-compute the DFT coefficients. We will only use some of them in
-     * sliding_dft().
+            f->sysTimestampMsg.tv_sec = anchor_time.tv_sec + ns / 1000000000;
+            f->sysTimestampMsg.tv_nsec = anchor_time.tv_nsec + ns % 1000000000;
+            normalize_timespec(&f->sysTimestampMsg);
+            outputFrame(f);
+        }
+
+        pthread_mutex_lock(&DumpFLARM.frame_mutex);
+        *tail = DumpFLARM.frame_free;
+        DumpFLARM.frame_free = queue;
+        pthread_cond_broadcast(&DumpFLARM.frame_cond);
+    }
+    pthread_mutex_unlock(&DumpFLARM.frame_mutex);
+
+    return NULL;
+}
+
+/* Subroutine: modesInitOutput()
+ * Description: fill the free list with the whole frame pool, set up the
+ *  sample clock and start the output thread
+ * Input: none
+ * Output: none
+ */
+static void modesInitOutput(void) {
+    uint64_t a = 12000000, b = decoder_options.input_rate, t;
+    int i;
+
+    pthread_mutex_init(&DumpFLARM.frame_mutex, NULL);
+    pthread_cond_init(&DumpFLARM.frame_cond, NULL);
+
+    for (i = 0; i < MODES_FRAME_POOL; i++)
+        DumpFLARM.frame_pool[i].next = i + 1 < MODES_FRAME_POOL ? &DumpFLARM.frame_pool[i + 1] : NULL;
+    DumpFLARM.frame_free = DumpFLARM.frame_pool;
+    DumpFLARM.frame_queue = NULL;
+    DumpFLARM.frame_queue_tail = &DumpFLARM.frame_queue;
+    DumpFLARM.output_exit = 0;
+
+    // 12MHz over the sample rate, as a reduced fraction
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    DumpFLARM.clock_mul = 12000000 / a;
+    DumpFLARM.clock_div = decoder_options.input_rate / a;
+
+    // Until the first block comes in, and for good in batch mode
+    DumpFLARM.anchor_clock = 0;
+    clock_gettime(CLOCK_REALTIME, &DumpFLARM.anchor_time);
+
+    pthread_create(&DumpFLARM.output_thread, NULL, outputThreadEntryPoint, NULL);
+}
+
+/* Subroutine: modesStopOutput()
+ * Description: wait for the output thread to be done with the queued frames
+ * Input: none
+ * Output: none
+ */
+static void modesStopOutput(void) {
+    pthread_mutex_lock(&DumpFLARM.frame_mutex);
+    DumpFLARM.output_exit = 1;
+    pthread_cond_broadcast(&DumpFLARM.frame_cond);
+    pthread_mutex_unlock(&DumpFLARM.frame_mutex);
+
+    pthread_join(DumpFLARM.output_thread, NULL);
+}
+
+/* Subroutine: demodulateBuffer()
+ * Description: consumer side of the sample ring, feed one whole block to
+ *  the demodulator
+ * Input:
+ *  buf: filled sample buffer
+ * Output: none
+ */
+static void demodulateBuffer(struct mag_buf *buf) {
+    if (buf->dropped) {
+        fprintf(stderr, "%llu samples dropped\n", (unsigned long long) buf->dropped);
+        DumpFLARM.stats_samples_dropped += buf->dropped;
+
+        // Start over after the gap, numbering the samples as the reader did
+        dump868_reset(decoder, dump868_sample_index(decoder) + buf->dropped);
+    }
+
+    // Resynchronize the system time of the sample clock
+    pthread_mutex_lock(&DumpFLARM.frame_mutex);
+    DumpFLARM.anchor_clock = buf->sampleTimestamp;
+    DumpFLARM.anchor_time = buf->sysTimestamp;
+    pthread_mutex_unlock(&DumpFLARM.frame_mutex);
+
+    dump868_push(decoder, buf->data, buf->length);
+
+    DumpFLARM.stats_samples_processed += buf->length;
+}
+
+/* Subroutine: decoderStats()
+ * Description: add the counters of a decoder that is done to the totals
+ * Input:
+ *  d: the decoder
+ * Output: none
+ */
+static void decoderStats(const struct dump868_decoder *d) {
+    struct dump868_stats stats;
+    unsigned c;
+
+    dump868_get_stats(d, &stats);
+    for (c = 0; c < decoder_options.channels; c++) {
+        DumpFLARM.stats_blocks += stats.blocks[c];
+        DumpFLARM.stats_blocks_squelched += stats.squelched[c];
+        if (stats.ring_high_water[c] > DumpFLARM.stats_ring_high_water)
+            DumpFLARM.stats_ring_high_water = stats.ring_high_water[c];
+        DumpFLARM.stats_candidates += stats.candidates[c];
+        DumpFLARM.stats_accepted += stats.accepted[c];
+        DumpFLARM.stats_dropped += stats.dropped[c];
+        DumpFLARM.stats_corrected += stats.corrected[c];
+        DumpFLARM.stats_combined += stats.combined[c];
+    }
+}
+
+/* Subroutine: modesStreamDecode()
+ * Description: consume the mag_buffers ring until the reader is done
+ * Input: none
+ * Output: none
+ */
+static void modesStreamDecode(void) {
+    struct dump868_options options = decoder_options;
+
+    // The reader hands over blocks already converted to signed samples
+    options.format = DUMP868_FORMAT_CS8;
+    if (!(decoder = dump868_create(&options, output_frame, NULL))) {
+        fprintf(stderr, "Out of memory allocating decoder.\n");
+        exit(1);
+    }
+
+#ifdef __linux__
+    if (DumpFLARM.demod_cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(DumpFLARM.demod_cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            fprintf(stderr, "Could not pin the demodulator thread to CPU %d.\n", DumpFLARM.demod_cpu);
+    }
+#endif
+
+    pthread_mutex_lock(&DumpFLARM.data_mutex);
+    while (!DumpFLARM.exit) {
+        struct mag_buf *buf;
+
+        if (DumpFLARM.first_free_buffer == DumpFLARM.first_filled_buffer) {
+            /* wait for more data */
+            exitWait(&DumpFLARM.data_cond, &DumpFLARM.data_mutex);
+            continue;
+        }
+
+        buf = &DumpFLARM.mag_buffers[DumpFLARM.first_filled_buffer];
+
+        // Process one buffer without holding the lock, so the reader can
+        // keep filling the rest of the ring meanwhile
+        pthread_mutex_unlock(&DumpFLARM.data_mutex);
+        demodulateBuffer(buf);
+        pthread_mutex_lock(&DumpFLARM.data_mutex);
+
+        DumpFLARM.first_filled_buffer = (DumpFLARM.first_filled_buffer + 1) % MODES_MAG_BUFFERS;
+        pthread_cond_signal(&DumpFLARM.data_cond);
+    }
+    pthread_mutex_unlock(&DumpFLARM.data_mutex);
+
+    dump868_flush(decoder);
+    decoderStats(decoder);
+    dump868_destroy(decoder);
+}
+
+//
+// =============================== Batch decoding ===========================
+//
+// Offline mode for large captures: the mapped --ifile is split into chunks
+// that are decoded independently by a pool of worker threads, each with its
+// own decoder. Every chunk is decoded from a frame's worth of samples
+// (dump868_frame_samples()) before its start, to warm up the demodulator, to
+// as many past its end, so that packets beginning near the end can be
+// completed, but only keeps
+// the packets that begin inside the chunk. The main thread collects chunks in
+// order, so the output comes out sorted by sample index.
+//
+#define BATCH_MAX_CHUNK_SAMPLES (1 << 26)   // 64M samples, 40 s of signal
+#define BATCH_DUP_WINDOW        (DUMP868_SYMBOL_SAMPLES * 2)
+#define BATCH_RECENT            8           // packets remembered for duplicate removal
+
+struct batch_chunk {
+    uint64_t start, end;                    // samples owned by this chunk
+    struct dump868_frame *frames;
+    unsigned nframes, alloc;
+    int done;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    struct batch_chunk *chunks;
+    unsigned nchunks;
+    unsigned next_chunk;                    // next chunk for a worker to pick up
+} batch;
+
+/* Packet handler of the batch workers: keep the packet if it belongs to the
+ * chunk being decoded. 'opaque' points to the worker's current chunk.
+ */
+static void batchCollect(void *opaque, const struct dump868_frame *frame) {
+    struct batch_chunk *chunk = *(struct batch_chunk **) opaque;
+
+    if (frame->sample_index < chunk->start || frame->sample_index >= chunk->end)
+        return;
+
+    if (chunk->nframes == chunk->alloc) {
+        chunk->alloc = chunk->alloc ? chunk->alloc * 2 : 64;
+        if (!(chunk->frames = realloc(chunk->frames, chunk->alloc * sizeof(*frame)))) {
+            fprintf(stderr, "Out of memory collecting batch frames.\n");
+            exit(1);
+        }
+    }
+
+    chunk->frames[chunk->nframes++] = *frame;
+}
+
+static void *batchWorkerEntryPoint(void *arg) {
+    struct dump868_options options = decoder_options;
+    struct batch_chunk *chunk = NULL;
+    struct dump868_decoder *d;
+    unsigned bytes = input_format_bytes(DumpFLARM.input_format);
+    uint64_t total = DumpFLARM.ifile_size / bytes, span;
+    struct converter_state *state = NULL;
+    iq_convert_fn convert = NULL;
+    int8_t *block = NULL;
+
+    MODES_NOTUSED(arg);
+
+    /* Plain unsigned captures are decoded straight from the mapping, the
+     * others go through a converter of our own, a block at a time
      */
-    for (i = 0; i < dft_points; i++)
-        coeffs[i] = cexp(I * 2. * M_PI * i / dft_points);
-
-    /* Read chunks of data piped from rtl_sdr utility and call sliding_dft()
-     * for each sample. The data comes in I/Q pairs, like: IQIQIQIQIQ...
-     * Individual values (either I or Q) range is (0, 255), and to convert to
-     * signed we need to subtract 127. No idea why RTL-SDR dongle doesn't use
-     * signed integer by default (looks like the hardware itself returns the
-     * data in this way).
+    if (DumpFLARM.input_format != INPUT_CU8 || DumpFLARM.dc_filter) {
+        options.format = DUMP868_FORMAT_CS8;
+        if (!(convert = init_converter(DumpFLARM.input_format, DumpFLARM.sample_rate, DumpFLARM.dc_filter, &state)) ||
+            !(block = malloc(MODES_MAG_BUF_SAMPLES * 2))) {
+            fprintf(stderr, "Out of memory allocating sample converter.\n");
+            exit(1);
+        }
+    }
+
+    if (!(d = dump868_create(&options, batchCollect, &chunk))) {
+        fprintf(stderr, "Out of memory allocating decoder.\n");
+        exit(1);
+    }
+    span = dump868_frame_samples(d);
+
+    while (!DumpFLARM.exit) {
+        uint64_t from, to;
+
+        pthread_mutex_lock(&batch.mutex);
+        if (batch.next_chunk == batch.nchunks) {
+            pthread_mutex_unlock(&batch.mutex);
+            break;
+        }
+        chunk = &batch.chunks[batch.next_chunk++];
+        pthread_mutex_unlock(&batch.mutex);
+
+        from = chunk->start > span ? chunk->start - span : 0;
+        to = chunk->end + span < total ? chunk->end + span : total;
+
+        dump868_reset(d, from);
+        if (!convert) {
+            dump868_push(d, DumpFLARM.ifile_data + from * 2, to - from);
+        } else {
+            reset_converter(state);
+            while (from < to) {
+                size_t len = to - from < MODES_MAG_BUF_SAMPLES ? to - from : MODES_MAG_BUF_SAMPLES;
+
+                convert(DumpFLARM.ifile_data + from * bytes, block, len, state);
+                dump868_push(d, block, len);
+                from += len;
+            }
+        }
+        dump868_flush(d);
+
+        pthread_mutex_lock(&batch.mutex);
+        chunk->done = 1;
+        pthread_cond_broadcast(&batch.cond);
+        pthread_mutex_unlock(&batch.mutex);
+    }
+
+    pthread_mutex_lock(&batch.mutex);
+    decoderStats(d);
+    pthread_mutex_unlock(&batch.mutex);
+    dump868_destroy(d);
+    if (convert)
+        cleanup_converter(state);
+    free(block);
+    return NULL;
+}
+
+/* Subroutine: modesBatchDecode()
+ * Description: decode the whole --ifile on DumpFLARM.batch_workers threads
+ *  and output the packets in sample order, without the duplicates decoded
+ *  from the overlapping parts of adjacent chunks
+ * Input: none
+ * Output: none
+ */
+static void modesBatchDecode(void) {
+    uint64_t total = DumpFLARM.ifile_size / input_format_bytes(DumpFLARM.input_format), chunk_samples;
+    struct dump868_frame recent[BATCH_RECENT];
+    unsigned nrecent = 0, c, i, k;
+    pthread_t *workers;
+    int w;
+
+    /* A few chunks per worker balances the load on small captures, big
+     * captures are cut in BATCH_MAX_CHUNK_SAMPLES pieces.
      */
+    chunk_samples = total / ((uint64_t) DumpFLARM.batch_workers * 4) + 1;
+    if (chunk_samples > BATCH_MAX_CHUNK_SAMPLES)
+        chunk_samples = BATCH_MAX_CHUNK_SAMPLES;
+    if (chunk_samples < DUMP868_FRAME_SAMPLES * 4 * (uint64_t) DumpFLARM.sample_rate / DUMP868_SAMPLE_RATE)
+        chunk_samples = DUMP868_FRAME_SAMPLES * 4 * (uint64_t) DumpFLARM.sample_rate / DUMP868_SAMPLE_RATE;
+
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+    batch.nchunks = (total + chunk_samples - 1) / chunk_samples;
+    batch.next_chunk = 0;
+    if (!(batch.chunks = calloc(batch.nchunks, sizeof(*batch.chunks))) ||
+        !(workers = calloc(DumpFLARM.batch_workers, sizeof(*workers)))) {
+        fprintf(stderr, "Out of memory allocating batch chunks.\n");
+        exit(1);
+    }
+
+    for (c = 0; c < batch.nchunks; c++) {
+        batch.chunks[c].start = c * chunk_samples;
+        batch.chunks[c].end = c + 1 < batch.nchunks ? (c + 1) * chunk_samples : total;
+    }
 
+    for (w = 0; w < DumpFLARM.batch_workers; w++)
+        pthread_create(&workers[w], NULL, batchWorkerEntryPoint, NULL);
 
+    for (c = 0; c < batch.nchunks && !DumpFLARM.exit; c++) {
+        struct batch_chunk *chunk = &batch.chunks[c];
 
+        pthread_mutex_lock(&batch.mutex);
+        while (!chunk->done && !DumpFLARM.exit)
+            exitWait(&batch.cond, &batch.mutex);
+        pthread_mutex_unlock(&batch.mutex);
+
+        if (!chunk->done)
+            break;
+
+        for (i = 0; i < chunk->nframes; i++) {
+            struct dump868_frame *f = &chunk->frames[i];
+
+            /* Floating point DFT state does not carry over between chunks, so
+             * a packet right on a boundary can come out of both neighbours a
+             * sample or two apart. Drop it if we just sent the same thing.
+             */
+            for (k = 0; k < nrecent && k < BATCH_RECENT; k++) {
+                struct dump868_frame *r = &recent[k];
+
+                if (r->channel == f->channel && r->length == f->length &&
+                    llabs((long long) (f->sample_index - r->sample_index)) < BATCH_DUP_WINDOW &&
+                    !memcmp(r->data, f->data, f->length))
+                    break;
+            }
+            if (k < nrecent && k < BATCH_RECENT)
+                continue;
+
+            output_frame(NULL, f);
+            recent[nrecent++ % BATCH_RECENT] = *f;
+        }
+
+        DumpFLARM.stats_samples_processed += chunk->end - chunk->start;
+        free(chunk->frames);
+    }
+
+    for (w = 0; w < DumpFLARM.batch_workers; w++)
+        pthread_join(workers[w], NULL);
+
+    free(workers);
+    free(batch.chunks);
+}
+
+/* Subroutine: modesInitRtlsdr()
+ * Description: start rtl_sdr with the configured options, piping the raw
+ *  samples to us
+ * Input: none
+ * Output: pipe to read the samples from, or NULL on error
+ */
+static FILE *modesInitRtlsdr(void) {
     //char *cmd = "rtl_sdr -f 868.05m -s 1.6m -g 14 -p 0 -";
 
     char cmd[1000];
     
-    sprintf(cmd, "rtl_sdr -f 868.05m -s 1.6m");
+    sprintf(cmd, "rtl_sdr -f %d -s %u", MODES_FLARM_FREQ, decoder_options.input_rate);
     
     if(DumpFLARM.gain!=0){
 
@@ -189,24 +1193,391 @@ int main(int argc, char **argv) {
 
     sprintf(cmd, "%s -",cmd);
 
-    FILE *fp;
+    return popen(cmd, "r");
+}
 
-    if ((fp = popen(cmd, "r")) == NULL) {
-        printf("Error opening pipe!\n");
-        return -1;
+/* Subroutine: channelSupported()
+ * Description: ask the library whether a channel can be decoded on its own
+ * Input:
+ *  options: decoder settings, the channels aside
+ *  offset: Hz from the tuned frequency to the channel
+ * Output: whether it can
+ */
+static int channelSupported(const struct dump868_options *options, int offset) {
+    struct dump868_options one = *options;
+    struct dump868_decoder *d;
+
+    one.channels = 1;
+    one.channel_offset[0] = offset;
+    if (!(d = dump868_create(&one, output_frame, NULL)))
+        return 0;
+    dump868_destroy(d);
+    return 1;
+}
+
+/* Subroutine: parseChannels()
+ * Description: set the channels to decode from a --channels argument, once
+ *  the sample rate is known
+ * Input:
+ *  list: comma separated frequencies in MHz, "all" for every channel of
+ *   the 200KHz raster around 868.2MHz that the sample rate covers without
+ *   touching DC or the band edge, or NULL to check the default ones
+ * Output: none, exits on a bad list
+ */
+static void parseChannels(const char *list) {
+    struct dump868_options options = decoder_options;
+    struct dump868_decoder *d;
+    char *copy, *freq, *save;
+    int limit = options.input_rate / 2 - DUMP868_CHANNEL_SPACING * 3 / 2, offset;
+    unsigned i;
+
+    // All the decoders created here are only asked whether they can be
+    options.slicer_threads = 0;
+    options.decode_threads = 0;
+
+    if (!list) {
+        // Keep the defaults
+    } else if (!strcmp(list, "all")) {
+        // 868.2MHz and up, then 867.8MHz and down, as far as the decoder goes
+        options.channels = 0;
+        for (offset = 868200000 - MODES_FLARM_FREQ;
+             offset <= limit && channelSupported(&options, offset); offset += DUMP868_CHANNEL_SPACING * 2)
+            options.channel_offset[options.channels++] = offset;
+        for (offset = 867800000 - MODES_FLARM_FREQ;
+             offset >= -limit && channelSupported(&options, offset); offset -= DUMP868_CHANNEL_SPACING * 2)
+            options.channel_offset[options.channels++] = offset;
+    } else {
+        copy = strdup(list);
+        options.channels = 0;
+        for (freq = strtok_r(copy, ",", &save); freq; freq = strtok_r(NULL, ",", &save)) {
+            if (options.channels == DUMP868_MAX_CHANNELS) {
+                fprintf(stderr, "At most %d channels can be decoded at once.\n", DUMP868_MAX_CHANNELS);
+                exit(1);
+            }
+            options.channel_offset[options.channels++] = lround(atof(freq) * 1e6) - MODES_FLARM_FREQ;
+        }
+        free(copy);
     }
 
+    // Let the library tell which ones it can not do
+    for (i = 0; i < options.channels; i++) {
+        if (!channelSupported(&options, options.channel_offset[i])) {
+            fprintf(stderr, "Channel %.3f MHz can not be decoded while tuned to %.3f MHz at %g MS/s.\n",
+                    (MODES_FLARM_FREQ + options.channel_offset[i]) / 1e6, MODES_FLARM_FREQ / 1e6,
+                    options.input_rate / 1e6);
+            exit(1);
+        }
+    }
+    if (!options.channels) {
+        fprintf(stderr, "No channels to decode.\n");
+        exit(1);
+    }
+
+    // Each one alone is fine, so too many of them landed in the same band
+    if (!(d = dump868_create(&options, output_frame, NULL))) {
+        fprintf(stderr, "At most %d channels within %.1f MHz of each other can be decoded at once.\n",
+                DUMP868_BAND_CHANNELS, DUMP868_SAMPLE_RATE / 2e6);
+        exit(1);
+    }
+    dump868_destroy(d);
 
-    while (true) {
+    decoder_options.channels = options.channels;
+    memcpy(decoder_options.channel_offset, options.channel_offset, sizeof(options.channel_offset));
+}
+
+/* Subroutine: parseCpus()
+ * Description: set the CPUs to pin threads to from a --cpu-affinity argument
+ * Input:
+ *  list: comma separated CPU numbers, the demodulator thread's first and
+ *   then one for each slicer thread
+ * Output: none, exits on a bad list
+ */
+static void parseCpus(const char *list) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF), cpu;
+    char *copy = strdup(list), *item, *save, *end;
+    int n = 0;
+
+    for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save), n++) {
+        cpu = strtol(item, &end, 10);
+        if (*end || end == item || cpu < 0 || cpu >= cpus || cpu >= CPU_SETSIZE) {
+            fprintf(stderr, "There is no CPU '%s' to pin to, they go from 0 to %ld.\n", item, cpus - 1);
+            exit(1);
+        }
+        if (n == 0) {
+            DumpFLARM.demod_cpu = cpu;
+        } else if (n <= DUMP868_MAX_CHANNELS) {
+            decoder_options.slicer_cpu[n - 1] = cpu;
+        } else {
+            fprintf(stderr, "At most %d slicer threads can be pinned.\n", DUMP868_MAX_CHANNELS);
+            exit(1);
+        }
+    }
+    free(copy);
+}
+
+/* Subroutine: parseRtltcp()
+ * Description: set the rtl_tcp server to connect to from an --rtltcp
+ *  argument
+ * Input:
+ *  server: host name or address, with an optional ":port". IPv6 addresses
+ *   with a port go in brackets, like [::1]:1234
+ * Output: none
+ */
+static void parseRtltcp(const char *server) {
+    char *copy = strdup(server), *port = NULL, *end;
+
+    if (copy[0] == '[' && (end = strchr(copy, ']'))) {
+        *end = '\0';
+        if (end[1] == ':')
+            port = end + 2;
+        memmove(copy, copy + 1, strlen(copy));
+    } else if ((end = strchr(copy, ':')) && !strchr(end + 1, ':')) {
+        *end = '\0';
+        port = end + 1;
+    }
+
+    DumpFLARM.rtltcp_host = copy;
+    DumpFLARM.rtltcp_port = strdup(port && *port ? port : MODES_RTLTCP_PORT);
+}
+
+/* Subroutine: main()
+ * Description: get chunks of data from STDIN and forward to sliding_dft()
+ * Input:
+ *  argc: argument counter
+ *  argv: array of arguments
+ * Output: exit code
+ */
+int main(int argc, char **argv) {
+    int j;
+    char *channels = NULL;
+    struct timespec start_time, end_time;
+    double elapsed;
+
+    modesInitConfig();
+
+
+    for (j = 1; j < argc; j++) {
+        int more = j+1 < argc; // There are more arguments
 
 
-        len = fread(raw_buffer, sizeof(raw_buffer[0]), sizeof(raw_buffer), fp);
-        for (i = 0; i < len; i += 2)
-            sliding_dft(raw_buffer[i] - 127, raw_buffer[i + 1] - 127);
+        if (!strcmp(argv[j],"--device-index") && more) {
+            DumpFLARM.dev_name = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--gain") && more) {
+            DumpFLARM.gain = (int) (atof(argv[++j])); 
+        } else if (!strcmp(argv[j],"--help")) {
+            showHelp();
+            exit(0);
+        } else if (!strcmp(argv[j],"--ppm") && more) {
+            DumpFLARM.ppm_error = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--enable-rtlsdr-biast")) {
+            DumpFLARM.enable_rtlsdr_biast = 1;
+        } else if (!strcmp(argv[j],"--net-port") && more) {
+            free(DumpFLARM.net_output_beast_ports);
+            DumpFLARM.net_output_beast_ports = strdup(argv[++j]);
+        }else if (!strcmp(argv[j],"--other") && more) {
+            DumpFLARM.other_options = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--ifile") && more) {
+            DumpFLARM.filename = strdup(argv[++j]);
+        } else if (!strcmp(argv[j],"--rtltcp") && more) {
+            parseRtltcp(argv[++j]);
+        } else if (!strcmp(argv[j],"--iformat") && more) {
+            if (input_format_parse(argv[++j], &DumpFLARM.input_format) < 0) {
+                fprintf(stderr, "Unknown sample format '%s'.\n", argv[j]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[j],"--dcfilter")) {
+            DumpFLARM.dc_filter = 1;
+        } else if (!strcmp(argv[j],"--throttle")) {
+            DumpFLARM.throttle = 1;
+        } else if (!strcmp(argv[j],"--raw")) {
+            DumpFLARM.raw = 1;
+        } else if (!strcmp(argv[j],"--workers") && more) {
+            DumpFLARM.batch_workers = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--dft-engine") && more) {
+            char *name = argv[++j];
+
+            if (!strcmp(name, "auto")) {
+                decoder_options.dft_engine = DUMP868_DFT_AUTO;
+            } else if (!strcmp(name, "scalar")) {
+                decoder_options.dft_engine = DUMP868_DFT_SCALAR;
+            } else if (!strcmp(name, "sse2")) {
+                decoder_options.dft_engine = DUMP868_DFT_SSE2;
+            } else if (!strcmp(name, "avx2")) {
+                decoder_options.dft_engine = DUMP868_DFT_AVX2;
+            } else if (!strcmp(name, "int")) {
+                decoder_options.dft_engine = DUMP868_DFT_INT;
+            } else {
+                fprintf(stderr, "Unknown DFT engine '%s'.\n\n", name);
+                showHelp();
+                exit(1);
+            }
+
+            if (!dump868_dft_engine_supported(decoder_options.dft_engine)) {
+                fprintf(stderr, "The %s DFT engine is not supported on this system.\n", name);
+                exit(1);
+            }
+        } else if (!strcmp(argv[j],"--preamble-errors") && more) {
+            int errors = atoi(argv[++j]);
+
+            if (errors < 0 || errors > DUMP868_MAX_PREAMBLE_ERRORS) {
+                fprintf(stderr, "--preamble-errors must be between 0 and %d.\n", DUMP868_MAX_PREAMBLE_ERRORS);
+                exit(1);
+            }
+            decoder_options.preamble_errors = errors;
+        } else if (!strcmp(argv[j],"--fix-crc") && more) {
+            DumpFLARM.nfix_crc = atoi(argv[++j]);
+
+            if (DumpFLARM.nfix_crc < 0 || DumpFLARM.nfix_crc > DUMP868_MAX_FIX_BITS) {
+                fprintf(stderr, "--fix-crc must be between 0 and %d.\n", DUMP868_MAX_FIX_BITS);
+                exit(1);
+            }
+            decoder_options.fix_bits = DumpFLARM.nfix_crc;
+        } else if (!strcmp(argv[j],"--net-no-corrected")) {
+            DumpFLARM.net_no_corrected = 1;
+        } else if (!strcmp(argv[j],"--no-combine")) {
+            decoder_options.combine = 0;
+        } else if (!strcmp(argv[j],"--symbol-sync")) {
+            decoder_options.symbol_sync = 1;
+        } else if (!strcmp(argv[j],"--squelch") && more) {
+            decoder_options.squelch_db = atof(argv[++j]);
+            if (decoder_options.squelch_db < 0) {
+                fprintf(stderr, "--squelch can not be negative.\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[j],"--channels") && more) {
+            channels = argv[++j];
+        } else if (!strcmp(argv[j],"--slicer-threads") && more) {
+            int threads = atoi(argv[++j]);
+
+            if (threads < 0 || threads > DUMP868_MAX_CHANNELS) {
+                fprintf(stderr, "--slicer-threads must be between 0 and %d.\n", DUMP868_MAX_CHANNELS);
+                exit(1);
+            }
+            decoder_options.slicer_threads = threads;
+        } else if (!strcmp(argv[j],"--decode-threads") && more) {
+            int threads = atoi(argv[++j]);
+
+            if (threads < 0 || threads > DUMP868_MAX_DECODE_THREADS) {
+                fprintf(stderr, "--decode-threads must be between 0 and %d.\n", DUMP868_MAX_DECODE_THREADS);
+                exit(1);
+            }
+            decoder_options.decode_threads = threads;
+        } else if (!strcmp(argv[j],"--cpu-affinity") && more) {
+            parseCpus(argv[++j]);
+        } else if (!strcmp(argv[j],"--sample-rate") && more) {
+            double rate = atof(argv[++j]);
+
+            if (!(rate > 0 && rate < 100) || !dump868_input_rate_supported(lround(rate * 1e6))) {
+                fprintf(stderr, "Sample rate %s MS/s is not supported.\n", argv[j]);
+                exit(1);
+            }
+            decoder_options.input_rate = lround(rate * 1e6);
+            DumpFLARM.sample_rate = decoder_options.input_rate;
+        } else {
+            fprintf(stderr,
+                    "Unknown or not enough arguments for option '%s'.\n\n",
+                    argv[j]);
+            showHelp();
+            exit(1);
+        }
+    }
+
+    // The channels depend on the sample rate, which may come after them
+    parseChannels(channels);
+
+    // rtl_sdr and rtl_tcp only speak unsigned 8-bit
+    if (!DumpFLARM.filename)
+        DumpFLARM.input_format = INPUT_CU8;
+    if (!(DumpFLARM.converter_function = init_converter(DumpFLARM.input_format, DumpFLARM.sample_rate,
+                                                        DumpFLARM.dc_filter, &DumpFLARM.converter_state))) {
+        fprintf(stderr, "Out of memory allocating sample converter.\n");
+        exit(1);
+    }
+
+    // Pinning one decoder's slicers to CPUs makes no sense with several
+    if (DumpFLARM.filename && DumpFLARM.batch_workers > 0) {
+        for (j = 0; j < DUMP868_MAX_CHANNELS; j++)
+            decoder_options.slicer_cpu[j] = -1;
+    }
+
+    /*
+     * Networking
+     *
+     * */
+
+    modesInitNet();
+
+    /* Print and send the decoded frames, and run the periodic net
+     * operations, on their own thread */
+    modesInitOutput();
+
+
+    /* Read chunks of data piped from rtl_sdr utility (or received from
+     * rtl_tcp, or mapped from --ifile) on a dedicated reader thread, and
+     * feed the demodulator with every block it hands over through the
+     * mag_buffers ring.
+     */
+    signal(SIGINT, sigintHandler);
+    signal(SIGTERM, sigintHandler);
+
+    modesInitBuffers();
+
+    if (DumpFLARM.filename && DumpFLARM.batch_workers > 0) {
+        modesInitFile();
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        modesBatchDecode();
+    } else {
+        if (DumpFLARM.filename) {
+            modesInitFile();
+            pthread_create(&DumpFLARM.reader_thread, NULL, fileReaderThreadEntryPoint, NULL);
+        } else if (DumpFLARM.rtltcp_host) {
+            pthread_create(&DumpFLARM.reader_thread, NULL, rtltcpReaderThreadEntryPoint, NULL);
+        } else {
+            FILE *fp;
+
+            if ((fp = modesInitRtlsdr()) == NULL) {
+                printf("Error opening pipe!\n");
+                return -1;
+            }
+            pthread_create(&DumpFLARM.reader_thread, NULL, readerThreadEntryPoint, fp);
+        }
 
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        modesStreamDecode();
     }
 
+    modesStopOutput();
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
 
+    fprintf(stderr, "%llu samples processed, %llu samples dropped\n",
+            (unsigned long long) DumpFLARM.stats_samples_processed,
+            (unsigned long long) DumpFLARM.stats_samples_dropped);
+    if (decoder_options.squelch_db > 0 && DumpFLARM.stats_blocks)
+        fprintf(stderr, "%llu of %llu channel blocks squelched (%.1f%%)\n",
+                (unsigned long long) DumpFLARM.stats_blocks_squelched,
+                (unsigned long long) DumpFLARM.stats_blocks,
+                100.0 * DumpFLARM.stats_blocks_squelched / DumpFLARM.stats_blocks);
+    if (decoder_options.slicer_threads)
+        fprintf(stderr, "Slicer rings filled up to %u of %d blocks\n",
+                DumpFLARM.stats_ring_high_water, DUMP868_RING_BLOCKS);
+    if (DumpFLARM.stats_candidates)
+        fprintf(stderr, "%llu of %llu candidate messages accepted (%.1f%%), %llu dropped\n",
+                (unsigned long long) DumpFLARM.stats_accepted,
+                (unsigned long long) DumpFLARM.stats_candidates,
+                100.0 * DumpFLARM.stats_accepted / DumpFLARM.stats_candidates,
+                (unsigned long long) DumpFLARM.stats_dropped);
+    if (DumpFLARM.nfix_crc)
+        fprintf(stderr, "%llu messages with bits corrected\n",
+                (unsigned long long) DumpFLARM.stats_corrected);
+    if (decoder_options.combine)
+        fprintf(stderr, "%llu messages combined from several receptions\n",
+                (unsigned long long) DumpFLARM.stats_combined);
+    if (elapsed > 0)
+        fprintf(stderr, "%.3f s elapsed, %.0f samples/s (%.2fx realtime)\n",
+                elapsed,
+                DumpFLARM.stats_samples_processed / elapsed,
+                DumpFLARM.stats_samples_processed / elapsed / DumpFLARM.sample_rate);
 
     return 0;
 }
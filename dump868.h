@@ -25,6 +25,7 @@
 #include <stdio.h>
 
 #include "anet.h"
+#include "convert.h"
 #include "net_io.h"
 
 #ifndef DUMPLIGHT_DUMPFLARM_H
@@ -36,14 +37,24 @@
 
 #define MODES_DEFAULT_PPM          0
 #define MODES_DEFAULT_FREQ         1090000000
+#define MODES_FLARM_FREQ           868050000                  // rtl_sdr tuning, channels are decoded around it
 #define MODES_DEFAULT_WIDTH        1000
 #define MODES_DEFAULT_HEIGHT       700
 #define MODES_RTL_BUFFERS          15                         // Number of RTL buffers
 #define MODES_RTL_BUF_SIZE         (16*16384)                 // 256k
 #define MODES_MAG_BUF_SAMPLES      (MODES_RTL_BUF_SIZE / 2)   // Each sample is 2 bytes
 #define MODES_MAG_BUFFERS          12                         // Number of magnitude buffers (should be smaller than RTL_BUFFERS for flowcontrol to work)
+#define MODES_FRAME_POOL           256                        // Decoded frames waiting for the output thread, at most
+#define MODES_EXIT_POLL_MS         100                        // Longest wait before a waiting thread looks at DumpFLARM.exit again
 #define MODES_AUTO_GAIN            -100                       // Use automatic gain
 #define MODES_MAX_GAIN             999999                     // Use max available gain
+#define MODES_RTLTCP_PORT          "1234"                     // Default rtl_tcp port
+#define MODES_RTLTCP_RCVBUF        (8*1024*1024)              // Socket receive buffer, 2.6 s of samples at 1.6 MS/s
+#define MODES_RTLTCP_TIMEOUT       5                          // Seconds without samples before reconnecting
+#define MODES_RTLTCP_SETTLE_MS     250                        // Samples discarded after connecting, tuned before our commands
+#define MODES_RTLTCP_MAX_LAG_MS    1000                       // Stream this far behind the wall clock has lost samples
+#define MODES_RTLTCP_DRIFT_BLOCKS  64                         // Blocks over which a lag within that is taken as clock drift
+#define MODES_RTLTCP_MAX_RETRY     32                         // Longest wait between connection attempts, seconds
 #define MODES_MSG_SQUELCH_DB       4.0                        // Minimum SNR, in dB
 #define MODES_MSG_ENCODER_ERRS     3                          // Maximum number of encoding errors
 
@@ -209,18 +220,36 @@ void normalize_timespec(struct timespec *ts);
 
 //======================== structure declarations =========================
 
-// Structure representing one magnitude buffer
+// Structure representing one sample buffer
 struct mag_buf {
-    uint16_t       *data;            // Magnitude data. Starts with Modes.trailing_samples worth of overlap from the previous block
-    unsigned        length;          // Number of valid samples _after_ overlap. Total buffer length is buf->length + Modes.trailing_samples.
+    int8_t         *data;            // Signed I/Q sample pairs (IQIQIQ...), MODES_MAG_BUF_SAMPLES pairs allocated
+    unsigned        length;          // Number of valid I/Q sample pairs in data
     uint64_t        sampleTimestamp; // Clock timestamp of the start of this block, 12MHz clock
     struct timespec sysTimestamp;    // Estimated system time at start of block
-    uint32_t        dropped;         // Number of dropped samples preceding this buffer
+    uint64_t        dropped;         // Number of dropped samples preceding this buffer
     double          total_power;     // Sum of per-sample input power (in the range [0.0,1.0] per sample), or 0 if not measured
 };
 
+// A decoded FLARM frame, as the decoder hands it over to the output thread.
+// They come from the DumpFLARM.frame_pool free list and go back to it once
+// printed and sent.
+struct flarmFrame {
+    struct flarmFrame *next;                    // Next in the output queue, or on the free list
+    uint64_t      sampleIndex;                  // Index of the first preamble sample
+    uint64_t      timestampMsg;                 // Timestamp of the message (12MHz clock)
+    struct timespec sysTimestampMsg;            // Timestamp of the message (system time)
+    double        signalLevel;                  // RSSI, in the range [0..1], as a fraction of full-scale power
+    float         signalNoise;                  // Signal to noise ratio, dB
+    int16_t       score;                        // Confidence in the bits, see dump868_frame.score
+    uint8_t       msglen;                       // Number of valid bytes in msg
+    uint8_t       channel;                      // Index in dump868_options.channel_offset
+    uint8_t       correctedbits;                // No. of bits corrected
+    uint8_t       receptions;                   // Receptions it was combined from
+    unsigned char msg[MODES_LONG_MSG_BYTES];    // Binary message
+};
+
 // Program global state
-struct {                             // Internal state
+extern struct _DumpFLARM {           // Internal state
     pthread_t       reader_thread;
 
     pthread_mutex_t data_mutex;      // Mutex to synchronize buffer access
@@ -231,18 +260,32 @@ struct {                             // Internal state
     unsigned        first_filled_buffer;                  // Entry in mag_buffers that has valid data and will be demodulated next. If equal to next_free_buffer, there is no unprocessed data.
     struct timespec reader_cpu_accumulator;               // CPU time used by the reader thread, copied out and reset by the main thread under the mutex
 
+    pthread_t       output_thread;
+    pthread_mutex_t frame_mutex;                          // Mutex to synchronize frame_pool and anchor access
+    pthread_cond_t  frame_cond;                           // Signalled when a frame is queued or freed
+    struct flarmFrame frame_pool[MODES_FRAME_POOL];       // Decoded frames, preallocated
+    struct flarmFrame *frame_free;                        // Frames in frame_pool that the decoder can fill
+    struct flarmFrame *frame_queue;                       // Frames waiting for the output thread, oldest first
+    struct flarmFrame **frame_queue_tail;                 // Where to link the next queued frame
+    int             output_exit;                          // Output thread to stop once frame_queue is empty
+    uint64_t        clock_mul, clock_div;                 // Sample index to 12MHz clock, as index * clock_mul / clock_div
+    uint64_t        anchor_clock;                         // 12MHz clock of the last block handed to the decoder,
+    struct timespec anchor_time;                          // and the system time it was received at
+
     unsigned        trailing_samples;                     // extra trailing samples in magnitude buffers
     double          sample_rate;                          // actual sample rate in use (in hz)
 
     int             fd;              // --ifile option file descriptor
-    //input_format_t  input_format;    // --iformat option
+    const uint8_t  *ifile_data;      // --ifile memory mapping of the whole capture
+    size_t          ifile_size;      // --ifile capture length, in bytes
+    input_format_t  input_format;    // --iformat option
     uint16_t       *maglut;          // I/Q -> Magnitude lookup table
     uint16_t       *log10lut;        // Magnitude -> log10 lookup table
-    int             exit;            // Exit from the main loop when true
+    volatile sig_atomic_t exit;      // Exit from the main loop when true, set by the signal handler
 
     // Sample conversion
     int            dc_filter;        // should we apply a DC filter?
-    //iq_convert_fn  converter_function;
+    iq_convert_fn  converter_function;
     struct converter_state *converter_state;
 
     // RTLSDR
@@ -254,6 +297,8 @@ struct {                             // Internal state
     int           ppm_error;
     int           enable_rtlsdr_biast;
     char*         other_options;
+    char *        rtltcp_host;       // --rtltcp server, instead of running rtl_sdr
+    char *        rtltcp_port;
 
 
     // Networking
@@ -293,6 +338,7 @@ struct {                             // Internal state
     char *net_bind_address;          // Bind address
     int   net_sndbuf_size;           // TCP output buffer size (64Kb * 2^n)
     int   net_verbatim;              // if true, send the original message, not the CRC-corrected one
+    int   net_no_corrected;          // if true, do not send CRC-corrected messages at all
     int   forward_mlat;              // allow forwarding of mlat messages to output ports
     int   quiet;                     // Suppress stdout
     uint32_t show_only;              // Only show messages from this ICAO
@@ -311,6 +357,8 @@ struct {                             // Internal state
     char *html_dir;                  // Path to www base directory.
     int   json_location_accuracy;    // Accuracy of location metadata: 0=none, 1=approx, 2=exact
     int   throttle;                  // When reading from a file, throttle file playback to realtime?
+    int   batch_workers;             // When reading from a file, decode it in parallel chunks on this many threads
+    int   demod_cpu;                 // CPU to pin the demodulator thread to, -1 for any
 
     int   json_aircraft_history_next;
     struct {
@@ -328,6 +376,16 @@ struct {                             // Internal state
     struct aircraft *aircrafts;
 
     // Statistics
+    uint64_t stats_samples_processed;  // I/Q samples handed to the demodulator
+    uint64_t stats_samples_dropped;    // I/Q samples discarded by the reader because the buffer ring was full
+    uint64_t stats_blocks;             // Demodulator blocks, times the number of channels
+    uint64_t stats_blocks_squelched;   // Of those, the ones the squelch kept out of frame detection
+    unsigned stats_ring_high_water;    // Most blocks ever queued for a slicer thread
+    uint64_t stats_candidates;         // Candidate messages (preamble matches) looked into
+    uint64_t stats_accepted;           // Of those, the ones that turned out to be messages
+    uint64_t stats_dropped;            // And the ones no decoding thread had room for
+    uint64_t stats_corrected;          // Messages with bits corrected through the CRC
+    uint64_t stats_combined;           // Messages combined from several receptions
 //    struct stats stats_current;
 //    struct stats stats_alltime;
 //    struct stats stats_periodic;
@@ -336,164 +394,3 @@ struct {                             // Internal state
 //    struct stats stats_5min;
 //    struct stats stats_15min;
 } DumpFLARM;
-
-// The struct we use to store information about a decoded message.
-struct modesMessage {
-    // Generic fields
-    unsigned char msg[MODES_LONG_MSG_BYTES];      // Binary message.
-    unsigned char verbatim[MODES_LONG_MSG_BYTES]; // Binary message, as originally received before correction
-    int           msgbits;                        // Number of bits in message
-    int           msgtype;                        // Downlink format #
-    uint32_t      crc;                            // Message CRC
-    int           correctedbits;                  // No. of bits corrected
-    uint32_t      addr;                           // Address Announced
-    addrtype_t    addrtype;                       // address format / source
-    uint64_t      timestampMsg;                   // Timestamp of the message (12MHz clock)
-    struct timespec sysTimestampMsg;              // Timestamp of the message (system time)
-    int           remote;                         // If set this message is from a remote station
-    double        signalLevel;                    // RSSI, in the range [0..1], as a fraction of full-scale power
-    int           score;                          // Scoring from scoreModesMessage, if used
-
-    datasource_t  source;                         // Characterizes the overall message source
-
-    // Raw data, just extracted directly from the message
-    // The names reflect the field names in Annex 4
-    unsigned IID; // extracted from CRC of DF11s
-    unsigned AA;
-    unsigned AC;
-    unsigned CA;
-    unsigned CC;
-    unsigned CF;
-    unsigned DR;
-    unsigned FS;
-    unsigned ID;
-    unsigned KE;
-    unsigned ND;
-    unsigned RI;
-    unsigned SL;
-    unsigned UM;
-    unsigned VS;
-    unsigned char MB[7];
-    unsigned char MD[10];
-    unsigned char ME[7];
-    unsigned char MV[7];
-
-    // Decoded data
-    unsigned altitude_valid : 1;
-    unsigned heading_valid : 1;
-    unsigned speed_valid : 1;
-    unsigned vert_rate_valid : 1;
-    unsigned squawk_valid : 1;
-    unsigned callsign_valid : 1;
-    unsigned ew_velocity_valid : 1;
-    unsigned ns_velocity_valid : 1;
-    unsigned cpr_valid : 1;
-    unsigned cpr_odd : 1;
-    unsigned cpr_decoded : 1;
-    unsigned cpr_relative : 1;
-    unsigned category_valid : 1;
-    unsigned gnss_delta_valid : 1;
-    unsigned from_mlat : 1;
-    unsigned from_tisb : 1;
-    unsigned spi_valid : 1;
-    unsigned spi : 1;
-    unsigned alert_valid : 1;
-    unsigned alert : 1;
-
-    unsigned metype; // DF17/18 ME type
-    unsigned mesub;  // DF17/18 ME subtype
-
-    // valid if altitude_valid:
-    int               altitude;         // Altitude in either feet or meters
-    altitude_unit_t   altitude_unit;    // the unit used for altitude
-    altitude_source_t altitude_source;  // whether the altitude is a barometric altude or a GNSS height
-    // valid if gnss_delta_valid:
-    int               gnss_delta;       // difference between GNSS and baro alt
-    // valid if heading_valid:
-    unsigned          heading;          // Reported by aircraft, or computed from from EW and NS velocity
-    heading_source_t  heading_source;   // what "heading" is measuring (true or magnetic heading)
-    // valid if speed_valid:
-    unsigned          speed;            // in kts, reported by aircraft, or computed from from EW and NS velocity
-    speed_source_t    speed_source;     // what "speed" is measuring (groundspeed / IAS / TAS)
-    // valid if vert_rate_valid:
-    int               vert_rate;        // vertical rate in feet/minute
-    altitude_source_t vert_rate_source; // the altitude source used for vert_rate
-    // valid if squawk_valid:
-    unsigned          squawk;           // 13 bits identity (Squawk), encoded as 4 hex digits
-    // valid if callsign_valid
-    char              callsign[9];      // 8 chars flight number
-    // valid if category_valid
-    unsigned category;          // A0 - D7 encoded as a single hex byte
-    // valid if cpr_valid
-    cpr_type_t cpr_type;        // The encoding type used (surface, airborne, coarse TIS-B)
-    unsigned cpr_lat;           // Non decoded latitude.
-    unsigned cpr_lon;           // Non decoded longitude.
-    unsigned cpr_nucp;          // NUCp/NIC value implied by message type
-
-    airground_t airground;      // air/ground state
-
-    // valid if cpr_decoded:
-    double decoded_lat;
-    double decoded_lon;
-
-    // Operational Status
-    struct {
-        unsigned valid : 1;
-        unsigned version : 3;
-
-        unsigned om_acas_ra : 1;
-        unsigned om_ident : 1;
-        unsigned om_atc : 1;
-        unsigned om_saf : 1;
-        unsigned om_sda : 2;
-
-        unsigned cc_acas : 1;
-        unsigned cc_cdti : 1;
-        unsigned cc_1090_in : 1;
-        unsigned cc_arv : 1;
-        unsigned cc_ts : 1;
-        unsigned cc_tc : 2;
-        unsigned cc_uat_in : 1;
-        unsigned cc_poa : 1;
-        unsigned cc_b2_low : 1;
-        unsigned cc_nac_v : 3;
-        unsigned cc_nic_supp_c : 1;
-        unsigned cc_lw_valid : 1;
-
-        unsigned nic_supp_a : 1;
-        unsigned nac_p : 4;
-        unsigned gva : 2;
-        unsigned sil : 2;
-        unsigned nic_baro : 1;
-
-        sil_type_t sil_type;
-        enum { ANGLE_HEADING, ANGLE_TRACK } track_angle;
-        heading_source_t hrd;
-
-        unsigned cc_lw;
-        unsigned cc_antenna_offset;
-    } opstatus;
-
-    // Target State & Status (ADS-B V2 only)
-    struct {
-        unsigned valid : 1;
-        unsigned altitude_valid : 1;
-        unsigned baro_valid : 1;
-        unsigned heading_valid : 1;
-        unsigned mode_valid : 1;
-        unsigned mode_autopilot : 1;
-        unsigned mode_vnav : 1;
-        unsigned mode_alt_hold : 1;
-        unsigned mode_approach : 1;
-        unsigned acas_operational : 1;
-        unsigned nac_p : 4;
-        unsigned nic_baro : 1;
-        unsigned sil : 2;
-
-        sil_type_t sil_type;
-        enum { TSS_ALTITUDE_MCP, TSS_ALTITUDE_FMS } altitude_type;
-        unsigned altitude;
-        float baro;
-        unsigned heading;
-    } tss;
-};
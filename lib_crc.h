@@ -25,6 +25,8 @@
     *                                                                   *
     *   Date        Version Comment                                     *
     *                                                                   *
+    *   2026-10-16  1.17    Added crc_ccitt() for whole buffers         *
+    *                                                                   *
     *   2008-04-20  1.16    Added CRC-CCITT routine for Kermit          *
     *                                                                   *
     *   2007-04-01  1.15    Added CRC16 calculation for Modbus          *
@@ -49,7 +51,11 @@
 
 
 
-#define CRC_VERSION     "1.16"
+#include <stddef.h>
+
+
+
+#define CRC_VERSION     "1.17"
 
 
 
@@ -64,3 +70,4 @@ unsigned short          update_crc_ccitt(  unsigned short crc, char c
 unsigned short          update_crc_dnp(    unsigned short crc, char c                 );
 unsigned short          update_crc_kermit( unsigned short crc, char c                 );
 unsigned short          update_crc_sick(   unsigned short crc, char c, char prev_byte );
+unsigned short          crc_ccitt(         unsigned short crc, const unsigned char *buf, size_t len );
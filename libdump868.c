@@ -0,0 +1,408 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// libdump868.c: embeddable block-streaming decoder API.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channelizer.h"
+#include "libdump868.h"
+#include "nrf905_demod.h"
+#include "resampler.h"
+
+// The public constants are spelled out, so that the public header does not
+// need to drag in the demodulator internals. Make sure they agree.
+#if DUMP868_SAMPLE_RATE != sample_rate || DUMP868_SYMBOL_SAMPLES != symbol_samples || \
+    DUMP868_FRAME_SAMPLES != packet_samples || DUMP868_MAX_FRAME_BYTES != max_packet_bytes || \
+    DUMP868_MAX_PREAMBLE_ERRORS != DEMOD_MAX_PREAMBLE_ERRORS || DUMP868_BAND_CHANNELS != DEMOD_MAX_CHANNELS || \
+    DUMP868_CHANNEL_SPACING != symbol_rate || DUMP868_RING_BLOCKS != DEMOD_RING_BLOCKS || \
+    DUMP868_MAX_DECODE_THREADS != DEMOD_MAX_DECODE_THREADS || DUMP868_MAX_FIX_BITS != DEMOD_MAX_FIX_BITS
+#error "libdump868.h constants are out of sync with nrf905_demod.h"
+#endif
+
+#define CONVERT_SAMPLES 4096      // CU8 samples converted at a time for the channelizer or resampler
+
+// One band of DUMP868_SAMPLE_RATE, and the channels demodulated in it
+struct dump868_band {
+    struct dump868_decoder *decoder;
+    struct demod_state     *demod;      // NULL if no channel is in this band
+    unsigned                channels;
+    uint8_t                 channel[DEMOD_MAX_CHANNELS];  // Decoder channel of each demodulator channel
+};
+
+struct dump868_decoder {
+    // Splits wideband input into bands, or brings other rates to
+    // DUMP868_SAMPLE_RATE for band 0. Both NULL at DUMP868_SAMPLE_RATE,
+    // where band 0 is fed directly.
+    struct channelizer *channelizer;
+    struct resampler   *resampler;
+    struct dump868_band band[CHANNELIZER_MAX_BANDS];
+    unsigned            in_samples, out_samples;  // in_samples input samples make out_samples demodulator samples
+    double              delay;          // Of the channelizer or resampler, in input samples
+    uint64_t            first_index;    // Of the first sample pushed since the last reset
+    uint64_t            pushed;         // Samples pushed since the last reset
+    dump868_format_t    format;
+    dump868_frame_fn    callback;
+    void               *opaque;
+    int                 threaded;       // Whether the bands have slicer threads
+    pthread_mutex_t     callback_mutex; // Then taken around the callback, which they all share
+};
+
+static enum demod_dft_engine dftEngine(dump868_dft_engine_t engine) {
+    switch (engine) {
+        case DUMP868_DFT_AUTO:   return DEMOD_DFT_AUTO;
+        case DUMP868_DFT_SCALAR: return DEMOD_DFT_SCALAR;
+        case DUMP868_DFT_SSE2:   return DEMOD_DFT_SSE2;
+        case DUMP868_DFT_AVX2:   return DEMOD_DFT_AVX2;
+        case DUMP868_DFT_INT:    return DEMOD_DFT_INT;
+        default:                 return -1;
+    }
+}
+
+// Bands the channelizer splits the input rate in, 1 if it is not needed
+static unsigned inputBands(unsigned rate) {
+    return rate == DUMP868_SAMPLE_RATE * 2 || rate == DUMP868_SAMPLE_RATE * 4 ? rate * 2 / DUMP868_SAMPLE_RATE : 1;
+}
+
+// Band and DFT bins of the channel at the given offset from the tuned
+// frequency. Bands are centered every DUMP868_SAMPLE_RATE / 2 (just the one
+// when the input is not split), and each channel goes to the band it is
+// closest to the center of. The bins are DUMP868_CHANNEL_SPACING apart, the
+// space frequency is half a spacing below the channel and the mark
+// frequency half a spacing above.
+static int channelBins(int offset, unsigned rate, unsigned *band, struct demod_channel *channel) {
+    int space, spacing = DUMP868_SAMPLE_RATE / 2, bands = inputBands(rate);
+    long b;
+
+    // Resampled input only keeps what fits in DUMP868_SAMPLE_RATE
+    if (bands == 1 && rate > DUMP868_SAMPLE_RATE)
+        rate = DUMP868_SAMPLE_RATE;
+    if ((offset - DUMP868_CHANNEL_SPACING / 2) % DUMP868_CHANNEL_SPACING ||
+        offset <= -(int) rate / 2 || offset >= (int) rate / 2)
+        return -1;
+
+    // The tuned frequency is the dongle's DC offset, keep both bins off it
+    if (offset == DUMP868_CHANNEL_SPACING / 2 || offset == -DUMP868_CHANNEL_SPACING / 2)
+        return -1;
+
+    if (bands == 1) {
+        b = 0;
+    } else {
+        b = lround((double) offset / spacing);
+        offset -= b * spacing;
+    }
+    *band = b & (bands - 1);
+    space = (offset - DUMP868_CHANNEL_SPACING / 2) / DUMP868_CHANNEL_SPACING;
+
+    // Negative frequencies wrap around to the top bins
+    channel->space_bin = space & (dft_points - 1);
+    channel->mark_bin = (space + 1) & (dft_points - 1);
+    return 0;
+}
+
+// Translate a demodulator frame for the library user
+static void decoderOutput(void *opaque, const struct demod_frame *frame) {
+    struct dump868_band *band = opaque;
+    struct dump868_decoder *decoder = band->decoder;
+    struct dump868_frame f;
+    uint64_t scaled = frame->sample_index * decoder->in_samples;
+    uint64_t index = scaled / decoder->out_samples;
+    double fraction = (scaled % decoder->out_samples + (double) frame->sample_fraction * decoder->in_samples) / decoder->out_samples;
+    int64_t whole;
+
+    // Demodulators count from 0 at every reset, in their own samples. The
+    // filter delay is seldom a whole number of samples, take it off before
+    // splitting the time in index and fraction.
+    fraction -= decoder->delay;
+    whole = (int64_t) floor(fraction);
+    if (whole < 0 && (uint64_t) -whole > index) {
+        index = 0;
+        fraction = 0;
+    } else {
+        index += whole;
+        fraction -= whole;
+    }
+    f.sample_index = decoder->first_index + index;
+    f.sample_fraction = fraction;
+    f.rms = frame->rms;
+    f.snr_db = frame->snr_db;
+    f.length = frame->length;
+    f.channel = band->channel[frame->channel];
+    f.corrected_bits = frame->corrected_bits;
+    f.receptions = frame->receptions;
+    f.score = frame->score;
+    memcpy(f.data, frame->packet, frame->length);
+
+    // Each demodulator hands its frames over one at a time, but the bands
+    // do not know about each other
+    if (decoder->threaded)
+        pthread_mutex_lock(&decoder->callback_mutex);
+    decoder->callback(decoder->opaque, &f);
+    if (decoder->threaded)
+        pthread_mutex_unlock(&decoder->callback_mutex);
+}
+
+static void channelizerOutput(void *opaque, unsigned band, const int8_t *iq, size_t n) {
+    struct dump868_decoder *decoder = opaque;
+
+    demod_feed(decoder->band[band].demod, iq, n);
+}
+
+static void resamplerOutput(void *opaque, const int8_t *iq, size_t n) {
+    struct dump868_decoder *decoder = opaque;
+
+    demod_feed(decoder->band[0].demod, iq, n);
+}
+
+// Hand signed samples to the channelizer or the resampler
+static void frontEndFeed(struct dump868_decoder *decoder, const int8_t *iq, size_t n) {
+    if (decoder->channelizer)
+        channelizer_feed(decoder->channelizer, iq, n);
+    else
+        resampler_feed(decoder->resampler, iq, n);
+}
+
+void dump868_default_options(struct dump868_options *options) {
+    unsigned i;
+
+    options->format = DUMP868_FORMAT_CU8;
+    options->input_rate = DUMP868_SAMPLE_RATE;
+    options->frame_bytes = DUMP868_MAX_FRAME_BYTES;
+    options->check_crc = 1;
+    options->dft_engine = DUMP868_DFT_AUTO;
+    options->preamble_errors = 0;
+    options->symbol_sync = 0;
+    options->squelch_db = 0;
+    options->channels = 2;
+    options->channel_offset[0] = 150000;    // 868.2MHz, tuned to 868.05MHz
+    options->channel_offset[1] = 350000;    // 868.4MHz
+    options->slicer_threads = 0;
+    for (i = 0; i < DUMP868_MAX_CHANNELS; i++)
+        options->slicer_cpu[i] = -1;
+    options->decode_threads = 0;
+    options->fix_bits = 0;
+    options->combine = 1;
+}
+
+int dump868_dft_engine_supported(dump868_dft_engine_t engine) {
+    return demod_dft_engine_supported(dftEngine(engine));
+}
+
+int dump868_input_rate_supported(unsigned rate) {
+    struct resampler *r;
+
+    if (rate == DUMP868_SAMPLE_RATE || inputBands(rate) > 1)
+        return 1;
+    if (!(r = resampler_create(rate, DUMP868_SAMPLE_RATE, resamplerOutput, NULL)))
+        return 0;
+    resampler_destroy(r);
+    return 1;
+}
+
+struct dump868_decoder *dump868_create(const struct dump868_options *options, dump868_frame_fn callback, void *opaque) {
+    struct dump868_decoder *decoder;
+    struct demod_config config[CHANNELIZER_MAX_BANDS];
+    struct demod_channel channel;
+    uint32_t wanted = 0;
+    unsigned i, b, bands, threads = 0;
+
+    if (options->format != DUMP868_FORMAT_CU8 && options->format != DUMP868_FORMAT_CS8)
+        return NULL;
+    if (options->frame_bytes > DUMP868_MAX_FRAME_BYTES || !callback)
+        return NULL;
+    if (options->preamble_errors > DUMP868_MAX_PREAMBLE_ERRORS)
+        return NULL;
+    if (options->channels < 1 || options->channels > DUMP868_MAX_CHANNELS)
+        return NULL;
+    if (options->decode_threads > DUMP868_MAX_DECODE_THREADS || options->fix_bits > DUMP868_MAX_FIX_BITS)
+        return NULL;
+
+    if (!(decoder = calloc(1, sizeof(*decoder))))
+        return NULL;
+    pthread_mutex_init(&decoder->callback_mutex, NULL);
+
+    // Sort the channels out to the band demodulators
+    bands = inputBands(options->input_rate);
+    for (b = 0; b < bands; b++) {
+        demod_default_config(&config[b]);
+        config[b].packet_bytes = options->frame_bytes;
+        config[b].use_crc = options->check_crc ? 1 : 0;
+        config[b].dft_engine = dftEngine(options->dft_engine);
+        config[b].preamble_errors = options->preamble_errors;
+        config[b].symbol_sync = options->symbol_sync ? 1 : 0;
+        config[b].squelch_db = options->squelch_db;
+        config[b].fix_bits = options->fix_bits;
+        config[b].combine = options->combine ? 1 : 0;
+        config[b].channels = 0;
+    }
+    for (i = 0; i < options->channels; i++) {
+        if (channelBins(options->channel_offset[i], options->input_rate, &b, &channel) < 0 ||
+            config[b].channels == DEMOD_MAX_CHANNELS) {
+            dump868_destroy(decoder);
+            return NULL;
+        }
+        decoder->band[b].channel[config[b].channels] = i;
+        config[b].channel[config[b].channels++] = channel;
+        wanted |= 1U << b;
+    }
+
+    decoder->in_samples = decoder->out_samples = 1;
+    if (bands > 1) {
+        if (!(decoder->channelizer = channelizer_create(bands, wanted, channelizerOutput, decoder))) {
+            dump868_destroy(decoder);
+            return NULL;
+        }
+        decoder->in_samples = bands / 2;
+        decoder->delay = channelizer_delay(decoder->channelizer);
+    } else if (options->input_rate != DUMP868_SAMPLE_RATE) {
+        if (!(decoder->resampler = resampler_create(options->input_rate, DUMP868_SAMPLE_RATE, resamplerOutput, decoder))) {
+            dump868_destroy(decoder);
+            return NULL;
+        }
+        resampler_ratio(decoder->resampler, &decoder->out_samples, &decoder->in_samples);
+        decoder->delay = resampler_delay(decoder->resampler);
+    }
+
+    for (b = 0; b < bands; b++) {
+        if (!config[b].channels)
+            continue;
+
+        // The band's share of the slicer threads, and their CPUs
+        config[b].slicer_threads = options->slicer_threads < config[b].channels ? options->slicer_threads : config[b].channels;
+        for (i = 0; i < config[b].slicer_threads; i++, threads++)
+            config[b].slicer_cpu[i] = threads < DUMP868_MAX_CHANNELS ? options->slicer_cpu[threads] : -1;
+        config[b].decode_threads = options->decode_threads;
+        decoder->threaded |= config[b].slicer_threads > 0 || config[b].decode_threads > 0;
+
+        decoder->band[b].decoder = decoder;
+        decoder->band[b].channels = config[b].channels;
+        if (!(decoder->band[b].demod = demod_create(&config[b], decoderOutput, &decoder->band[b]))) {
+            dump868_destroy(decoder);
+            return NULL;
+        }
+    }
+
+    decoder->format = options->format;
+    decoder->callback = callback;
+    decoder->opaque = opaque;
+    return decoder;
+}
+
+void dump868_push(struct dump868_decoder *decoder, const void *samples, size_t nsamples) {
+    int8_t block[CONVERT_SAMPLES * 2];
+    const uint8_t *iq = samples;
+    size_t len, i;
+
+    decoder->pushed += nsamples;
+
+    if (!decoder->channelizer && !decoder->resampler) {
+        if (decoder->format == DUMP868_FORMAT_CU8)
+            demod_feed_cu8(decoder->band[0].demod, samples, nsamples);
+        else
+            demod_feed(decoder->band[0].demod, samples, nsamples);
+        return;
+    }
+
+    if (decoder->format == DUMP868_FORMAT_CS8) {
+        frontEndFeed(decoder, samples, nsamples);
+        return;
+    }
+
+    // Same conversion as demod_feed_cu8(), a block at a time, 255 clamped
+    // to 127
+    while (nsamples) {
+        len = nsamples < CONVERT_SAMPLES ? nsamples : CONVERT_SAMPLES;
+        for (i = 0; i < len * 2; i++)
+            block[i] = (iq[i] < 255 ? iq[i] : 254) - 127;
+
+        frontEndFeed(decoder, block, len);
+        iq += len * 2;
+        nsamples -= len;
+    }
+}
+
+void dump868_reset(struct dump868_decoder *decoder, uint64_t sample_index) {
+    unsigned b;
+
+    if (decoder->channelizer)
+        channelizer_reset(decoder->channelizer);
+    if (decoder->resampler)
+        resampler_reset(decoder->resampler);
+    for (b = 0; b < CHANNELIZER_MAX_BANDS; b++) {
+        if (decoder->band[b].demod)
+            demod_reset(decoder->band[b].demod, 0);
+    }
+    decoder->first_index = sample_index;
+    decoder->pushed = 0;
+}
+
+void dump868_flush(struct dump868_decoder *decoder) {
+    unsigned b;
+
+    for (b = 0; b < CHANNELIZER_MAX_BANDS; b++) {
+        if (decoder->band[b].demod)
+            demod_flush(decoder->band[b].demod);
+    }
+}
+
+uint64_t dump868_sample_index(const struct dump868_decoder *decoder) {
+    return decoder->first_index + decoder->pushed;
+}
+
+uint64_t dump868_frame_samples(const struct dump868_decoder *decoder) {
+    return (uint64_t) DUMP868_FRAME_SAMPLES * decoder->in_samples / decoder->out_samples + (uint64_t) ceil(decoder->delay);
+}
+
+void dump868_get_stats(const struct dump868_decoder *decoder, struct dump868_stats *stats) {
+    const struct dump868_band *band;
+    struct demod_stats s;
+    unsigned b, i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (b = 0; b < CHANNELIZER_MAX_BANDS; b++) {
+        band = &decoder->band[b];
+        if (!band->demod)
+            continue;
+
+        demod_get_stats(band->demod, &s);
+        for (i = 0; i < band->channels; i++) {
+            stats->blocks[band->channel[i]] = s.blocks;
+            stats->squelched[band->channel[i]] = s.squelched[i];
+            stats->ring_high_water[band->channel[i]] = s.ring_high_water[i];
+            stats->candidates[band->channel[i]] = s.candidates[i];
+            stats->accepted[band->channel[i]] = s.accepted[i];
+            stats->dropped[band->channel[i]] = s.dropped[i];
+            stats->corrected[band->channel[i]] = s.corrected[i];
+            stats->combined[band->channel[i]] = s.combined[i];
+        }
+    }
+}
+
+void dump868_destroy(struct dump868_decoder *decoder) {
+    unsigned b;
+
+    if (!decoder)
+        return;
+    for (b = 0; b < CHANNELIZER_MAX_BANDS; b++)
+        demod_destroy(decoder->band[b].demod);
+    if (decoder->channelizer)
+        channelizer_destroy(decoder->channelizer);
+    resampler_destroy(decoder->resampler);
+    pthread_mutex_destroy(&decoder->callback_mutex);
+    free(decoder);
+}
@@ -0,0 +1,173 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// libdump868.h: embeddable block-streaming decoder API.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBDUMP868_H
+#define LIBDUMP868_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The demodulator works on I/Q samples at exactly this rate. The decoder
+// also takes 2 or 4 times as many, and splits them in bands of this rate
+// itself, or resamples other rates to it (see dump868_input_rate_supported()).
+// Either way the channel offsets are from the tuned frequency, 868.05MHz
+// being the usual one.
+#define DUMP868_SAMPLE_RATE       1600000
+#define DUMP868_SYMBOL_SAMPLES    16        // Samples per nRF905 symbol
+#define DUMP868_FRAME_SAMPLES     8064      // Samples from the start of the preamble to the end of the longest frame
+#define DUMP868_MAX_FRAME_BYTES   29
+#define DUMP868_MAX_PREAMBLE_ERRORS 4
+#define DUMP868_MAX_CHANNELS      32        // Channels one stream can be demodulated on
+#define DUMP868_BAND_CHANNELS     7         // Of those, channels within DUMP868_SAMPLE_RATE / 4 of the same band center
+#define DUMP868_CHANNEL_SPACING   100000    // Hz, channels are odd multiples of half this from the tuned frequency
+#define DUMP868_RING_BLOCKS       128       // Blocks of samples that can wait for a slicer thread
+#define DUMP868_MAX_DECODE_THREADS 16       // Per band
+#define DUMP868_MAX_FIX_BITS      2
+
+// Layout of the sample blocks pushed to the decoder
+typedef enum {
+    DUMP868_FORMAT_CU8,      // Unsigned 8-bit I/Q pairs, 127 is zero (rtl_sdr output)
+    DUMP868_FORMAT_CS8       // Signed 8-bit I/Q pairs
+} dump868_format_t;
+
+// Implementations of the sliding DFT. The floating point ones have bit for
+// bit identical output.
+typedef enum {
+    DUMP868_DFT_AUTO,        // Fastest floating point one this CPU supports
+    DUMP868_DFT_SCALAR,      // Portable reference
+    DUMP868_DFT_SSE2,
+    DUMP868_DFT_AVX2,
+    DUMP868_DFT_INT          // Integer only, drift free: for FPU-less CPUs and receivers that never restart
+} dump868_dft_engine_t;
+
+// Decoder settings, fill with dump868_default_options() and change what is needed
+struct dump868_options {
+    dump868_format_t format;
+    unsigned input_rate;     // Sample rate pushed, Hz
+    unsigned frame_bytes;    // Expected frame size, 0 for "whatever passes the CRC"
+    int      check_crc;      // Only deliver frames with a good CRC
+    dump868_dft_engine_t dft_engine;
+    unsigned preamble_errors;  // Preamble symbols allowed to be wrong, 0 to DUMP868_MAX_PREAMBLE_ERRORS
+    int      symbol_sync;      // Recover the symbol timing and look for frames once per symbol instead
+                               // of at every sample: much less work, less sensitive to weak signals
+    double   squelch_db;       // Skip frame detection where the signal is not this many dB over the
+                               // noise floor, 0 to never skip
+    unsigned channels;         // Number of channels to decode, 1 to DUMP868_MAX_CHANNELS
+    int      channel_offset[DUMP868_MAX_CHANNELS];  // Hz from the tuned frequency to each channel, an odd
+                               // multiple of DUMP868_CHANNEL_SPACING / 2, not +-DUMP868_CHANNEL_SPACING / 2
+                               // (DC) and within +-(input_rate - DUMP868_CHANNEL_SPACING) / 2. At 2 or 4 times
+                               // DUMP868_SAMPLE_RATE, the sample rate is split in bands centered every
+                               // DUMP868_SAMPLE_RATE / 2, at most DUMP868_BAND_CHANNELS channels each. Other
+                               // rates are resampled, which keeps DUMP868_SAMPLE_RATE of bandwidth at most.
+    unsigned slicer_threads;   // Look for frames on this many threads of their own, each with a share of the
+                               // channels, 0 to do it in dump868_push(). Per band, at most one per channel.
+    int      slicer_cpu[DUMP868_MAX_CHANNELS];  // CPU to pin each slicer thread to, -1 for any. Threads are
+                               // numbered band after band. Only supported on Linux.
+    unsigned decode_threads;   // Decode candidate frames (preamble matches) on this many threads of their own,
+                               // per band, up to DUMP868_MAX_DECODE_THREADS, 0 to decode them where they are found. Frames may then come out of
+                               // order, and candidates that find the threads too far behind are dropped.
+    unsigned fix_bits;         // Correct up to this many wrong bits through the CRC, up to DUMP868_MAX_FIX_BITS.
+                               // Only for check_crc and frame_bytes == DUMP868_MAX_FRAME_BYTES. 0 for none.
+    int      combine;          // Combine receptions of a frame that fail on their own with its resends (within
+                               // a second, across the channels of a band). Only for check_crc and a frame_bytes.
+};
+
+// Decoder counters
+struct dump868_stats {
+    uint64_t blocks[DUMP868_MAX_CHANNELS];     // Per channel, blocks of samples demodulated
+    uint64_t squelched[DUMP868_MAX_CHANNELS];  // Of those, the blocks the squelch kept out of frame detection
+    unsigned ring_high_water[DUMP868_MAX_CHANNELS];  // Per channel, most blocks ever queued for its slicer
+                               // thread, out of DUMP868_RING_BLOCKS. 0 without slicer threads.
+    uint64_t candidates[DUMP868_MAX_CHANNELS]; // Per channel, candidate frames: preamble matches, those within
+                               // a symbol of each other counted once
+    uint64_t accepted[DUMP868_MAX_CHANNELS];   // Of those, the ones that turned out to be frames
+    uint64_t dropped[DUMP868_MAX_CHANNELS];    // And the ones no decoding thread had room for
+    uint64_t corrected[DUMP868_MAX_CHANNELS];  // Frames delivered with bits corrected
+    uint64_t combined[DUMP868_MAX_CHANNELS];   // Frames delivered combined from several receptions
+};
+
+// One decoded frame
+struct dump868_frame {
+    uint64_t sample_index;   // Index of the first preamble sample, counted from the first sample pushed
+    double   sample_fraction; // Time of arrival past sample_index, 0 to 1 sample, for multilateration
+    double   rms;            // Mean signal power of the channel over the frame, unnormalized I/Q units
+    double   snr_db;         // Of the frame over the noise floor of the channel
+    unsigned length;         // Number of valid bytes in data
+    unsigned channel;        // Index in dump868_options.channel_offset, by default 0 = 868.2MHz, 1 = 868.4MHz
+    unsigned corrected_bits; // Bits of data corrected through the CRC, 0 if it was good as received
+    unsigned receptions;     // Receptions it was combined from, 1 if it made it on its own
+    int      score;          // Confidence in the bits: 10 * log10 of one over the expected number of wrong
+                             // ones, from their soft decisions. Higher is better, about 80 at most.
+    uint8_t  data[DUMP868_MAX_FRAME_BYTES];
+};
+
+// Called from dump868_push() for every decoded frame, or with slicer threads
+// from them, one at a time. The frame is only valid for the duration of the
+// call.
+typedef void (*dump868_frame_fn)(void *opaque, const struct dump868_frame *frame);
+
+struct dump868_decoder;
+
+void dump868_default_options(struct dump868_options *options);
+
+// Whether the DFT engine was built in and runs on this CPU
+int dump868_dft_engine_supported(dump868_dft_engine_t engine);
+
+// Whether samples can be pushed at this rate: DUMP868_SAMPLE_RATE, 2 or 4
+// times that, or any rate that the resampler can bring to DUMP868_SAMPLE_RATE
+// (one that reduces to a small enough fraction of it, 2.048 or 2.4MHz
+// for example)
+int dump868_input_rate_supported(unsigned rate);
+
+// Returns NULL if the options are invalid or we are out of memory. Decoders
+// are independent, different threads may each push to their own.
+struct dump868_decoder *dump868_create(const struct dump868_options *options, dump868_frame_fn callback, void *opaque);
+
+// Decode nsamples I/Q pairs. The block is read in place, and may have any
+// length; the signal history carries over to the next push. With slicer
+// threads, the frames in it may still be on their way when this returns.
+void dump868_push(struct dump868_decoder *decoder, const void *samples, size_t nsamples);
+
+// Wait until every frame in the samples pushed so far has been delivered
+void dump868_flush(struct dump868_decoder *decoder);
+
+// Discard the signal history, and number the next sample pushed as sample_index
+void dump868_reset(struct dump868_decoder *decoder, uint64_t sample_index);
+
+// Index that the next sample pushed will get
+uint64_t dump868_sample_index(const struct dump868_decoder *decoder);
+
+// Samples to push from the start of a frame until it is delivered, at the
+// decoder's sample rate: DUMP868_FRAME_SAMPLES, plus the band splitting
+// delay above DUMP868_SAMPLE_RATE
+uint64_t dump868_frame_samples(const struct dump868_decoder *decoder);
+
+// Counters since dump868_create(), dump868_reset() leaves them alone. Call
+// dump868_flush() first for exact ones with slicer threads.
+void dump868_get_stats(const struct dump868_decoder *decoder, struct dump868_stats *stats);
+
+void dump868_destroy(struct dump868_decoder *decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -401,16 +401,16 @@ static void completeWrite(struct net_writer *writer, void *endptr) {
 //
 // Write raw output in Beast Binary format with Timestamp to TCP clients
 //
-static void modesSendBeastOutput(struct modesMessage *mm) {
+static void modesSendBeastOutput(struct flarmFrame *mm) {
 
     //fprintf(stderr, "Preparing message\n");
 
-    int msgLen = mm->msgbits / 8;
+    int msgLen = mm->msglen;
     char *p = prepareWrite(&DumpFLARM.beast_out, 2 + 2 * (7 + msgLen));
     char ch;
     int j;
     int sig;
-    unsigned char *msg = (DumpFLARM.net_verbatim ? mm->verbatim : mm->msg);
+    unsigned char *msg = mm->msg;
 
 
     if (!p) {
@@ -487,7 +487,11 @@ static void send_beast_heartbeat(struct net_service *service)
 
 //=========================================================================
 //
-void modesQueueOutput(struct modesMessage *mm) {
+void modesQueueOutput(struct flarmFrame *mm) {
+    // Corrected messages are likely right, but not certainly
+    if (mm->correctedbits && DumpFLARM.net_no_corrected)
+        return;
+
 //    int is_mlat = (mm->source == SOURCE_MLAT);
 //
 //    if (!is_mlat && mm->correctedbits < 2) {
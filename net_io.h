@@ -24,7 +24,7 @@
 // Describes a networking service (group of connections)
 
 struct aircraft;
-struct modesMessage;
+struct flarmFrame;
 struct client;
 struct net_service;
 typedef int (*read_fn)(struct client *, char *);
@@ -76,7 +76,7 @@ struct client *createGenericClient(struct net_service *service, int fd);
 //struct net_service *makeFatsvOutputService(void);
 
 void modesInitNet(void);
-void modesQueueOutput(struct modesMessage *mm);
+void modesQueueOutput(struct flarmFrame *mm);
 void modesNetPeriodicWork(void);
 
 // TODO: move these somewhere else
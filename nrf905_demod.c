@@ -15,8 +15,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* For pthread_attr_setaffinity_np() */
+#define _GNU_SOURCE
+
 #include <complex.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +32,13 @@
 
 
 #include "lib_crc.h"
+#include "nrf905_demod.h"
+
+/* Vector DFT engines, see dft_block_sse2() */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define DEMOD_X86
+#include <immintrin.h>
+#endif
 
 
 /* Some subs are subs for organizational purposes only. They're not intended
@@ -35,50 +47,6 @@
  */
 #define forceinline __inline__ __attribute__((always_inline)) static
 
-/* "Magic" constants... These come directly or indirectly from the nRF905
- * specification. Here is a simplified explanation about how this program works.
- * First of all, nRF905 sends two kinds of pulses: mark & space. Mark means "1"
- * symbol and space means "0" (or vice-versa; who cares, more on this later).
- * If you tune nRF905 to use 868.2MHz (AKA "channel 117"), space is sent at a
- * slightly lower frequency (868.15MHz) while mark is sent at a slightly higher
- * one (868.25MHz). There's nothing interesting at exactly 868.2MHz (at least,
- * not for this program). So, fact #1: there's 100KHz separation between mark
- * & space.
- * Then, enter the sample rate. If we read 1 million of samples every second
- * (1MHz sample rate) each symbol (and therefore, mark/space pulse) will be
- * spread across just 10 samples. This means that we only have a serie of
- * 10 values to figure out the frequency. By the way, this serie is in
- * "time domain". Fourier transform turns it into "frequency domain".
- * But for 10 input values, it will produce 10 output values.
- * Thus, 10 samples => 10 frequencies. Which frequencies? Intuitively enough,
- * our 1MHz sample rate is equally split in 10 "bins" spaced by 100KHz.
- * Fact #2: each symbol has just enough samples to make it possible to
- * discriminate mark/space. Which means that we can tune to 868.15MHz, and
- * "bin 0" will filter our spaces, and "bin 1" will filter our marks...
- * Except we can not use "bin 0", because it is somewhat special (DC).
- * Instead, we tune to 868.05MHz and get "bin 1" as space and "bin 2" as mark.
- * Then we get "bin 3" and "bin 4" as space & mark for the next channel
- * (868.4MHz, AKA "channel 118"). And perhaps the next channel... And so on
- * until "bin 6", which wraps and gets us a "negative frequency" (that is,
- * something below 868.05MHz that we're tuned to). Let's not talk about bins
- * 6-10 for now.
- * Finally, fact #3: computers are not impressed when we round up our
- * arithmetics to 10, they prefer 16. That's why the sampling rate is 1.6MHz
- * and we have 16 samples per symbol.
- */
-#define symbol_samples      (16)
-#define symbol_rate         (100000)
-#define max_packet_bytes    (29)
-#define preamble_bits       (20)
-#define packet_samples      (symbol_samples * 2 * (preamble_bits + max_packet_bytes * 8))
-#define dft_points          (symbol_samples)
-#define sample_rate         (symbol_rate * symbol_samples)
-#define buffer_size         (1 << 13)
-#define smooth_buffer_size  (1 << 3)
-#define average_n           (7)
-
-
-
 #if buffer_size < packet_samples
 #error "Adjust buffer_size to fit at least one packet + preamble!"
 #endif
@@ -87,164 +55,1115 @@
 #error "buffer sizes has to be a power of 2!"
 #endif
 
+/* Samples are demodulated a block at a time: the DFT engine goes through the
+ * whole block first, then bit_slicer() through its output. A packet is
+ * detected when bit_slicer() reaches its last sample, and by then the level
+ * ring of its channel already holds the rest of the block. frame_level()
+ * still has to reach the start of the packet, which limits the block size.
+ */
+#define DEMOD_BLOCK_SAMPLES (buffer_size - packet_samples)
+
+#if DEMOD_BLOCK_SAMPLES < 1
+#error "buffer_size leaves no room for DFT blocks!"
+#endif
+
+/* The I/Q ring only has to hold a block and the DFT window before it: the
+ * vector engines write the block at once, and then subtract every sample
+ * again dft_points later.
+ */
+#define iq_ring_size        (256)
+
+#if iq_ring_size < DEMOD_BLOCK_SAMPLES + dft_points || (iq_ring_size & (iq_ring_size - 1))
+#error "Adjust iq_ring_size to a power of 2 that fits a block and a DFT window!"
+#endif
+
+/* Channel levels, see frame_level(), are kept level_shift bits short of the
+ * space minus mark power, so that a whole packet of them at full scale
+ * (2 * (128 * dft_points)^2 per sample) still adds up to less than 2^32
+ */
+#define level_shift         (4)
+
+/* The noise floor follows packets up a bit (see squelch_block()), so the
+ * signal to noise ratio of a packet takes it from before the packet, out of
+ * a history of noise_history blocks. That is enough for a packet, and some
+ * more, in blocks of DEMOD_BLOCK_SAMPLES.
+ */
+#define noise_history       (128)
+
+#if noise_history * DEMOD_BLOCK_SAMPLES < 2 * packet_samples || (noise_history & (noise_history - 1))
+#error "Adjust noise_history to a power of 2 that outlasts a packet!"
+#endif
+
+/* A candidate packet is decoded up to a symbol and a block after its
+ * preamble matched (see candidate_add()), from the same symbol bitmap
+ */
+#if packet_samples - preamble_bits * symbol_samples + symbol_samples + DEMOD_BLOCK_SAMPLES > buffer_size
+#error "Candidate packets outlive their symbols, adjust buffer_size!"
+#endif
+
+/* The sliced symbols of each channel are kept in a bitmap with one row per
+ * sample phase (position within the symbol period): every symbol that
+ * bit_slicer() compares with another one is a whole number of symbol periods
+ * away from it, so they are all in the same row, next to each other.
+ * Each row holds the last bitmap_columns symbols of its phase.
+ */
+#define bitmap_columns      (buffer_size / symbol_samples)
+#define bitmap_words        (bitmap_columns / 64)
+
+#if bitmap_columns % 64 || preamble_bits > 32
+#error "Adjust buffer_size to a whole number of bitmap words per row!"
+#endif
+
+/* Symbol timing recovery, see symbol_strobe(): the eye opening of each
+ * sample phase is a moving average over about 2^eye_shift symbols, and the
+ * early-late gate compares the phases eye_gate samples to either side of
+ * the strobe.
+ */
+#define eye_shift           (4)
+#define eye_gate            (symbol_samples / 4)
+
+/* Squelch, see squelch_block(): once open, it only closes when the signal
+ * falls this much below the opening level
+ */
+#define squelch_hysteresis_db (2.0)
+
+/* The DFT engines compute the bins of the channels in "lanes": the space
+ * bin of channel c in lane 2c, its mark bin in lane 2c + 1. The vector
+ * engines do 4 lanes (2 channels) at a time, so the number of lanes in use
+ * is rounded up to a multiple of 4, and the spare ones go to bin 0.
+ */
+#define dft_lanes           ((DEMOD_MAX_CHANNELS + 1) * 2)
+
+#if dft_lanes % 4
+#error "dft_lanes has to be a whole number of vectors!"
+#endif
+
+/* Fixed point precision of the dft_block_int() twiddle factors */
+#define SDFT_Q (14)
+
+/* Slicer threads, see slicer_wait(): how long to poll the other side of a
+ * ring before going to sleep, and how full the ring has to be before the
+ * feeding thread bothers to wake up a sleeping slicer. Samples come in
+ * blocks of well under 0.1 ms at 1.6 MS/s, so this wakes it up about once
+ * per ms instead of once per block.
+ */
+#define slicer_spins        (256)
+#define slicer_wake_blocks  (DEMOD_RING_BLOCKS / 8)
+
+/* Samples from the end of a packet (where its preamble is matched) back to
+ * the first symbol after the preamble
+ */
+#define payload_back        (packet_samples - preamble_bits * symbol_samples)
+
+/* Retransmission combining, see candidate_combine(). Receptions that fail
+ * on their own are kept in combine_slots slots for combine_window samples,
+ * keyed by their first combine_key_bytes (the sender address, in FLARM)
+ * with up to combine_key_errors wrong bits. The LLR of a single reception
+ * of a bit is clipped at llr_max, so that one overconfident reception can
+ * still be outvoted.
+ */
+#define combine_slots       (16)
+#define combine_key_bytes   (4)
+#define combine_key_errors  (2)
+#define combine_window      (sample_rate)
+#define llr_max             (24.f)
+
+/* Preamble matches of a channel that are less than a symbol apart are
+ * candidates for the same packet, see candidate_add(): a clean packet
+ * usually matches at several neighbouring sample phases in a row. They are
+ * decoded together, in order, and the first one that makes it wins.
+ */
+struct candidate_hits {
+    uint64_t sample;                 // Absolute index of the sample of the first match
+    uint16_t bit[symbol_samples];    // cb_idx_bit at each match
+    float level[symbol_samples];     // frame_level() at each match
+    float noise;                     // Noise floor of the channel before the first one, see noise_before()
+    uint8_t count;
+};
+
+/* A candidate packet waiting for a decoding thread, with a copy of the
+ * symbols of its channel (and of the sliding sums behind them) as they were
+ * when it was found
+ */
+struct demod_candidate {
+    uint64_t symbols[symbol_samples][bitmap_words] __attribute__((aligned(DEMOD_CACHE_LINE)));
+    int32_t soft[buffer_size];
+    struct candidate_hits hits;
+    struct demod_state *owner;       // The context that found it
+    uint8_t channel;                 // On the owner
+    struct demod_candidate *next;    // In the queue or in the free list
+};
+
+/* Decoding threads and the candidates they share. A single mutex guards
+ * both lists: a candidate is taken and given back once per packet-sized
+ * burst of preamble matches at most, nowhere near once per sample.
+ */
+struct demod_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;             // Something queued, or stop
+    pthread_cond_t idle;             // Nothing queued nor being decoded
+    pthread_mutex_t output_mutex;    // Taken around output
+    struct demod_candidate *free, *head, *tail;
+    unsigned busy;                   // Queued or being decoded
+    bool stop;
+
+    pthread_t *threads;
+    uint8_t nthreads;
+    struct demod_candidate *candidates;  // DEMOD_CANDIDATES of them
+};
 
+/* A packet as decoded from one of the matches of a candidate, see
+ * candidate_decode()
+ */
+struct candidate_result {
+    uint8_t packet[max_packet_bytes];
+    uint16_t length;                 // 0 if it is not a packet (yet)
+    uint16_t bad_manchester;         // Invalid Manchester pairs, UINT16_MAX if it was not decoded to the end
+    uint8_t corrected;               // Bits corrected through the CRC
+    uint8_t receptions;              // Receptions combined into it
+    float toa;                       // Samples from the match to the middle of the first symbol, see packet_toa()
+    float llr[max_packet_bytes * 8]; // Log-likelihood ratio of each bit, positive for "1", see packet_llr()
+};
+
+/* A packet that failed, waiting for its resends, see candidate_combine() */
+struct combine_slot {
+    uint64_t sample;                 // Absolute index of the end of the last reception
+    uint8_t receptions;              // 0 for a free slot
+    uint8_t key[combine_key_bytes];  // First bytes, as decided from the LLRs so far
+    float llr[max_packet_bytes * 8]; // Sum over the receptions
+};
+
+/* The slots, shared with the slicer contexts and the decoding threads */
+struct demod_combiner {
+    pthread_mutex_t mutex;
+    struct combine_slot slot[combine_slots];
+};
+
+/* One raw I/Q sample pair, as it came in. The DFT engines convert to
+ * whatever they compute with, and the ring stays 4 times smaller than it
+ * would be with complex floats.
+ */
+struct iq_sample {
+    int8_t i, q;
+};
+
+/* DFT engine: transform n samples, see dft_block_scalar() */
+typedef void (*dft_block_fn)(struct demod_state *d, const int8_t *iq, unsigned n, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES]);
+
+/* One block on its way to a slicer thread: the DFT output of the channels
+ * of the thread. Sized for them when the ring is allocated.
+ */
+struct slicer_block {
+    uint64_t first;                  // Absolute index of the first sample
+    unsigned n;
+    int32_t diff[][DEMOD_BLOCK_SAMPLES];
+};
 
-/* Here we store the precomputed coefficients for Discrete Fourier Transform.
- * "But isn't it terribly slow?!" Glad you asked; in this specific case,
- * DFT is actually faster than FFT! That is because due to the nature of the
- * demodulator, we can reuse the results of the computation of the previous
- * samples. Besides that, we don't need all the 16 frequency bins for the 16
- * samples, just 2 (mark/space) per channel.
+/* A slicer thread and the single-producer, single-consumer ring that feeds
+ * it. The feeding thread only writes 'head', the slicer only 'tail', each on
+ * its own cache line; a slot belongs to whoever is on its side of them. The
+ * mutex is only taken to sleep and to wake up the other side.
  */
-static complex float coeffs[dft_points];
+struct demod_slicer {
+    _Atomic uint32_t head __attribute__((aligned(DEMOD_CACHE_LINE)));  // Blocks published so far
+    uint32_t high_water;             // Most blocks ever queued
+    _Atomic uint32_t tail __attribute__((aligned(DEMOD_CACHE_LINE)));  // Blocks sliced so far
+    _Atomic uint32_t waiting __attribute__((aligned(DEMOD_CACHE_LINE)));  // Threads asleep on cond
+    _Atomic bool stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
 
-/* Intermediary values of the signal demodulation process are stored in
+    /* The channels it slices, and the demodulator context that does it */
+    struct demod_state *parent, *context;
+    uint8_t first_channel, channels;
+
+    unsigned char *ring;             // DEMOD_RING_BLOCKS slots of block_size bytes
+    size_t block_size;
+} __attribute__((aligned(DEMOD_CACHE_LINE)));
+
+/* Everything the demodulator remembers from one sample to the next.
+ * Intermediary values of the signal demodulation process are stored in
  * circular buffers. It works by overwriting the oldest values with the newest
  * ones. Each circular buffer allocates 2 variables: the buffer (prefixed with
  * "cb_buf_") and the current element index (prefixed with "cb_idx_").
+ * Keeping all of it in one structure (instead of globals and "static" locals)
+ * allows several independent demodulators in the same process, e.g. one per
+ * worker thread. The structure is cache line aligned, and so is every block
+ * of state that is touched together for each sample.
  */
-static complex float cb_buf_iq[buffer_size];
-static uint16_t cb_idx_iq;
+struct demod_state {
+    /* Discrete Fourier Transform of the last dft_points samples, at the
+     * bin of each lane
+     */
+    complex float dft[dft_lanes];
+
+    /* Here we store the precomputed coefficients for Discrete Fourier
+     * Transform. "But isn't it terribly slow?!" Glad you asked; in this
+     * specific case, DFT is actually faster than FFT! That is because due to
+     * the nature of the demodulator, we can reuse the results of the
+     * computation of the previous samples. Besides that, we don't need all
+     * the 16 frequency bins for the 16 samples, just 2 (mark/space) per
+     * channel. One coefficient per lane.
+     */
+    complex float coeffs[dft_lanes];
+    uint8_t lanes;                   // Lanes in use, a multiple of 4
+
+    /* dft_block_int() state, see there */
+    int32_t sdft_re[dft_lanes], sdft_im[dft_lanes];
+    int16_t twiddle_re[dft_lanes][dft_points], twiddle_im[dft_lanes][dft_points];
+    uint8_t sdft_phase;
+
+    /* Absolute index of the sample being processed */
+    uint64_t sample_index;
+    uint16_t cb_idx_iq;
+
+    /* How many samples of the current block are in the level rings past
+     * the one being sliced
+     */
+    uint16_t block_lag;
+
+    dft_block_fn dft_block;
+
+    /* Per-channel bit_slicer() state, see there */
+    int32_t cb_buf_pcm[DEMOD_MAX_CHANNELS][smooth_buffer_size] __attribute__((aligned(DEMOD_CACHE_LINE)));
+    uint16_t cb_idx_pcm[DEMOD_MAX_CHANNELS];
+    uint16_t cb_idx_bit[DEMOD_MAX_CHANNELS];  // Number of symbols sliced, mod 2^16
+    int32_t sliding_sum[DEMOD_MAX_CHANNELS];
+    uint32_t preamble_word;          // preamble_pattern as a bitmap row, first symbol in bit 0
+
+    /* Symbol timing recovery state, see symbol_strobe() */
+    int32_t eye[DEMOD_MAX_CHANNELS][symbol_samples] __attribute__((aligned(DEMOD_CACHE_LINE)));
+    uint8_t strobe_countdown[DEMOD_MAX_CHANNELS];
+
+    /* Candidate packets, see candidate_add(). Preambles are not looked for
+     * before decoded_until, where the last packet of the channel ends; the
+     * decoding threads move it forward, if any.
+     */
+    struct candidate_hits hits[DEMOD_MAX_CHANNELS];
+    _Atomic uint64_t decoded_until[DEMOD_MAX_CHANNELS];
+    struct demod_pool *pool;         // Decoding threads, shared with the slicer contexts
+    struct demod_combiner *combiner; // Failed receptions, likewise; NULL to not combine them
+
+    /* Squelch state, see squelch_block(), and the noise floor at the start
+     * of the last few blocks, see noise_before()
+     */
+    float noise_floor[DEMOD_MAX_CHANNELS];
+    float cb_buf_noise[DEMOD_MAX_CHANNELS][noise_history];
+    uint64_t noise_sample[noise_history];  // First sample of each of those blocks
+    uint8_t cb_idx_noise;
+    float squelch_open, squelch_close;   // Power ratios over the noise floor
+    uint16_t squelch_hang[DEMOD_MAX_CHANNELS];
+
+    struct demod_stats stats;
+
+    /* Settings, and where decoded packets go */
+    struct demod_config config;
+    demod_output_fn output;
+    void *opaque;
+
+    /* Slicer threads, see demod_create(); only their own context slices
+     * when there are any
+     */
+    struct demod_slicer *slicers;
+    uint8_t nslicers;
+    pthread_mutex_t output_mutex;    // Taken by the slicers around output
+
+    /* Sliced symbols of each channel, see symbol_at(), and the sliding
+     * sums they were sliced from (the soft decisions), in a ring in the
+     * order they were sliced
+     */
+    uint64_t symbols[DEMOD_MAX_CHANNELS][symbol_samples][bitmap_words] __attribute__((aligned(DEMOD_CACHE_LINE)));
+    int32_t soft[DEMOD_MAX_CHANNELS][buffer_size] __attribute__((aligned(DEMOD_CACHE_LINE)));
+
+    /* Running sum of the level of each channel, mod 2^32, see
+     * frame_level()
+     */
+    uint32_t cb_buf_level[DEMOD_MAX_CHANNELS][buffer_size] __attribute__((aligned(DEMOD_CACHE_LINE)));
+    uint16_t cb_idx_level[DEMOD_MAX_CHANNELS];
+
+    /* Raw I/Q samples, the last block and the DFT window before it */
+    struct iq_sample cb_buf_iq[iq_ring_size] __attribute__((aligned(DEMOD_CACHE_LINE)));
+} __attribute__((aligned(DEMOD_CACHE_LINE)));
 
 /* Circular buffer accessors. These are macros instead of subroutines mainly
  * because there are many different data types for buffers to handle. Raw I/Q
- * samples are complex, magnitudes are integer, decoded bits are characters.
+ * samples are byte pairs, magnitudes are integer.
+ * They operate on the buffers of the demodulator state 'd' in scope.
  * cb_write(buffer_name, X) inserts X into the last position of the buffer.
  * cb_readn(buffer_name, N) reads from Nth position of the buffer, where 0 is
  * the last position, 1 is the previous position, and so on.
  */
-#define cb_mask(n) (sizeof(cb_buf_##n) / sizeof(cb_buf_##n[0]) - 1)
-#define cb_write(n, v) (cb_buf_##n[(cb_idx_##n++) & cb_mask(n)] = (v))
-#define cb_readn(n, i) (cb_buf_##n[(cb_idx_##n + (~i)) & cb_mask(n)])
+#define cb_mask(n) (sizeof(d->cb_buf_##n) / sizeof(d->cb_buf_##n[0]) - 1)
+#define cb_write(n, v) (d->cb_buf_##n[(d->cb_idx_##n++) & cb_mask(n)] = (v))
+#define cb_readn(n, i) (d->cb_buf_##n[(d->cb_idx_##n + (~i)) & cb_mask(n)])
 
 /* To make any sense of the output, complex number has to be "squashed" into
  * good old float. However, we do not use sqrt() because it is too expensive!
  */
 #define magnitude(v) (creal(v) * creal(v) + cimag(v) * cimag(v))
 
+/* Manchester decoding, see candidate_decode(). Each byte of a bitmap row
+ * holds 4 symbol pairs, the first one in bits 0-1: manchester_table has
+ * their bits (the first symbol of each pair) and which of them are valid,
+ * the first pair in bit 3. The bail out heuristic allows invalid bits up to
+ * half of the bits so far: for the valid bits of a whole packet byte, the
+ * first one in bit 7, manchester_slack has the most that may be invalid
+ * before it, minus 4 per byte before it.
+ */
+struct manchester_pairs {
+    uint8_t data, valid;
+};
+
+static struct manchester_pairs manchester_table[256];
+static int8_t manchester_slack[256];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+/* CRC error correction, see candidate_decode(). The CRC of a packet with
+ * wrong bits is the CRC of the wrong bits alone (the "syndrome", as the
+ * CRC is linear), so it tells where they are: crc_syndrome has, for the
+ * syndrome of every single and double bit error in a packet of
+ * max_packet_bytes, the bit positions (counted from the first one, plus 1)
+ * in the bottom and top byte. Some double errors share their syndrome:
+ * CRC-CCITT only guarantees to tell apart packets that differ in 4 bits,
+ * not 5. Those are marked syndrome_ambiguous, and not corrected.
+ */
+#define syndrome_ambiguous  (0xffff)
+
+static uint16_t crc_syndrome[1 << 16];
+static pthread_once_t syndrome_once = PTHREAD_ONCE_INIT;
+
 /* Each nRF905 transmission starts with a pattern called "preamble". It is
  * something that is clearly distinguishable from the noise. In this case,
  * alternation of "0" and "1" symbols. We just try to match this specific bit
  * pattern against the RF stream. Almost like a regular expression.
  */
-const uint8_t preamble_pattern[preamble_bits] = { 1,0,1,0,1,0,1,0,1,0,1,0,0,1,1,0,0,1,1,0 };
+static const uint8_t preamble_pattern[preamble_bits] = { 1,0,1,0,1,0,1,0,1,0,1,0,0,1,1,0,0,1,1,0 };
 
-/* Runtime configuration globals.
+/* Subroutine: symbol_write()
+ * Description: slice a symbol into the channel bitmap, and keep what it was
+ *  sliced from
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ *  sum: sliding sum of the sample, "1" if positive
+ * Output: none
  */
-static uint8_t packet_bytes = 0, use_crc = 1;
+forceinline void symbol_write(struct demod_state *d, const uint8_t channel, const int32_t sum) {
+    uint16_t n = d->cb_idx_bit[channel]++;
+    uint16_t column = (n / symbol_samples) & (bitmap_columns - 1);
+    uint64_t *word = &d->symbols[channel][n % symbol_samples][column / 64];
+    uint64_t mask = 1ULL << (column % 64);
 
+    *word = (*word & ~mask) | (-(uint64_t) (sum > 0) & mask);
+    d->soft[channel][n & (buffer_size - 1)] = sum;
+}
 
+/* Subroutine: soft_bit()
+ * Description: soft decision on a Manchester-coded bit of a packet: the
+ *  sliding sum of its first symbol minus that of its second one. The
+ *  further from zero, the more certain.
+ * Input:
+ *  soft: sliding sums of the channel, or a copy of them
+ *  n: cb_idx_bit of the first symbol of the packet after the preamble
+ *  i: ordinal of the bit in the packet
+ * Output: the decision, positive for "1"
+ */
+forceinline float soft_bit(const int32_t soft[buffer_size], const uint16_t n, const unsigned i) {
+    uint16_t first = n + i * 2 * symbol_samples;
 
+    return (float) ((int64_t) soft[first & (buffer_size - 1)] - soft[(uint16_t) (first + symbol_samples) & (buffer_size - 1)]);
+}
 
-void stringtobin(char input[], unsigned char * msg){
+/* Subroutine: symbol_at()
+ * Description: read back a sliced symbol. Same as
+ *  cb_readn(bit[channel], back), if the symbols were in a circular buffer.
+ * Input:
+ *  symbols: bitmap of the channel, or a copy of it
+ *  bit: number of symbols sliced into it, mod 2^16 (see cb_idx_bit)
+ *  back: how many samples before the last one
+ * Output: the symbol
+ */
+forceinline uint8_t symbol_at(uint64_t symbols[symbol_samples][bitmap_words], const uint16_t bit, const uint16_t back) {
+    uint16_t n = bit - 1 - back;
+    uint16_t column = (n / symbol_samples) & (bitmap_columns - 1);
 
-    //printf("Input: %s | ", input);
+    return (symbols[n % symbol_samples][column / 64] >> (column % 64)) & 1;
+}
+
+/* Subroutine: symbol_row()
+ * Description: read back up to 32 consecutive symbols of the same phase,
+ *  starting with the one 'back' samples before the last one and going
+ *  forward in time in steps of symbol_samples
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ *  back: how many samples before the last one is the first symbol
+ * Output: the symbols, the first one in bit 0. Bits above the last sliced
+ *  symbol of the row are garbage.
+ */
+forceinline uint32_t symbol_row(struct demod_state *d, const uint8_t channel, const uint16_t back) {
+    uint16_t n = d->cb_idx_bit[channel] - 1 - back;
+    uint16_t column = (n / symbol_samples) & (bitmap_columns - 1);
+    const uint64_t *row = d->symbols[channel][n % symbol_samples];
+    uint64_t bits = row[column / 64] >> (column % 64);
+
+    if (column % 64 > 32)
+        bits |= row[(column / 64 + 1) % bitmap_words] << (64 - column % 64);
+    return bits;
+}
+
+/* Subroutine: symbol_strobe()
+ * Description: symbol timing recovery. Mark and space only stand out
+ *  cleanly in the middle of a symbol; near the transitions the sliding sum
+ *  shrinks towards zero. So the average magnitude of the sliding sum is
+ *  kept for each of the symbol_samples sample phases, and the strobe is
+ *  kept in the middle of the widest eye opening by an early-late gate:
+ *  once per symbol, if the phase a bit later than the strobe has the wider
+ *  eye than the one a bit earlier, the next strobe comes one sample late,
+ *  and the other way around.
+ *  Symbols are still written at every sample, so once the strobe has
+ *  settled on a packet, its row of the bitmap is the one that holds it.
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ *  sum: sliding sum of the sample
+ * Output: whether the sample is the strobe of its symbol
+ */
+forceinline bool symbol_strobe(struct demod_state *d, const uint8_t channel, const int32_t sum) {
+    uint16_t n = d->cb_idx_bit[channel] - 1;
+    uint16_t phase = n % symbol_samples;
+    int32_t *eye = d->eye[channel];
+    int32_t early, late, margin;
+
+    eye[phase] += ((sum < 0 ? -sum : sum) - eye[phase]) >> eye_shift;
+
+    if (--d->strobe_countdown[channel])
+        return false;
+
+    /* Dead band, so that a flat eye (noise, or the top of a strong one)
+     * does not make the strobe wander
+     */
+    early = eye[(phase - eye_gate) & (symbol_samples - 1)];
+    late = eye[(phase + eye_gate) & (symbol_samples - 1)];
+    margin = eye[phase] >> 3;
+    if (late - early > margin)
+        d->strobe_countdown[channel] = symbol_samples + 1;
+    else if (early - late > margin)
+        d->strobe_countdown[channel] = symbol_samples - 1;
+    else
+        d->strobe_countdown[channel] = symbol_samples;
+    return true;
+}
 
-    int i;
-    uint8_t str_len = strlen(input);
+/* Subroutine: level_block()
+ * Description: keep track of the level of a channel: the magnitude of the
+ *  space minus mark power. Noise gives about as much power to both, a
+ *  transmission a lot more to one of them, so this is the power of the
+ *  transmission, if any, and of the noise in one bin otherwise. It goes
+ *  into a running sum, so that the level over any stretch of the last
+ *  buffer_size samples is just the difference of two of its values.
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ *  diff: space minus mark power for each sample
+ *  n: number of samples
+ * Output: mean level of the block, level_shift bits short
+ */
+forceinline float level_block(struct demod_state *d, const uint8_t channel, const int32_t *diff, unsigned n) {
+    uint32_t sum = cb_readn(level[channel], 0), first = sum;
+    unsigned k;
 
-    for (i = 0; i < (str_len / 2); i++) {
-        sscanf(input + 2*i, "%02x", &msg[i]);
-        //printf("bytearray %d: %02x\n", i, msg[i]);
+    for (k = 0; k < n; k++) {
+        sum += ((uint32_t) (diff[k] < 0 ? -diff[k] : diff[k]) + (1 << level_shift >> 1)) >> level_shift;
+        cb_write(level[channel], sum);
     }
+    return (float) (sum - first) / n;
+}
+
+/* Subroutine: squelch_block()
+ * Description: follow the noise floor of a channel, and decide whether a
+ *  block is worth looking for packets in. The noise floor is a moving
+ *  average of the block levels, clipped at twice the floor so that packets
+ *  hardly move it. With only a few independent DFT windows per block, noise
+ *  alone easily doubles the level of a block, so it is an average rather
+ *  than a minimum.
+ *  A packet is detected at its end, by looking back packet_samples at
+ *  its start, so the squelch has to stay open until the last packet that
+ *  could have started in a loud block is over.
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ *  level: mean level of the block, see level_block()
+ *  n: number of samples
+ * Output: whether to look for packets in the block, always without squelch
+ */
+static bool squelch_block(struct demod_state *d, const uint8_t channel, const float level, unsigned n) {
+    float *noise = &d->noise_floor[channel];
+    bool open;
 
+    if (*noise == 0)
+        *noise = level;
+    d->cb_buf_noise[channel][d->cb_idx_noise & (noise_history - 1)] = *noise;
 
+    if (level > *noise * (d->squelch_hang[channel] ? d->squelch_close : d->squelch_open))
+        d->squelch_hang[channel] = packet_samples + n;
+
+    *noise += (fminf(level, *noise * 2) - *noise) / 32;
+    if (!(d->config.squelch_db > 0))
+        return true;
+
+    open = d->squelch_hang[channel] != 0;
+    d->squelch_hang[channel] = d->squelch_hang[channel] > n ? d->squelch_hang[channel] - n : 0;
+    if (!open)
+        d->stats.squelched[channel]++;
+    return open;
 }
 
-/* Subroutine: output()
- * Description: print the decoded packet, timestamp, RSSI and channel ID
+/* Subroutine: noise_before()
+ * Description: noise floor of a channel at the start of the block a sample
+ *  is in, or as far back as there is history
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ *  sample: absolute index of the sample
+ * Output: the noise floor, level_shift bits short
+ */
+static float noise_before(struct demod_state *d, const uint8_t channel, const uint64_t sample) {
+    uint8_t idx = d->cb_idx_noise, k;
+
+    for (k = 1; k < noise_history && d->noise_sample[idx & (noise_history - 1)] > sample; k++)
+        idx--;
+    return d->cb_buf_noise[channel][idx & (noise_history - 1)];
+}
+
+/* Subroutine: frame_level()
+ * Description: signal level of the packet we've just decoded, from the
+ *  running sum of level_block(): it is taken for every preamble match, and
+ *  those come in bursts in noise.
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ * Output: mean level over the packet_samples samples up to the one being
+ *  sliced, level_shift bits short
+ */
+forceinline float frame_level(struct demod_state *d, const uint8_t channel) {
+    uint16_t lag = d->block_lag;
+    uint32_t sum = cb_readn(level[channel], lag) - cb_readn(level[channel], (lag + packet_samples));
+
+    return (float) sum / packet_samples;
+}
+
+/* Subroutine: hit_sample()
+ * Description: absolute index of the sample a candidate matched at
+ * Input:
+ *  hits: the candidate
+ *  h: which of its matches
+ * Output: the index
+ */
+forceinline uint64_t hit_sample(const struct candidate_hits *hits, const uint8_t h) {
+    return hits->sample + (uint16_t) (hits->bit[h] - hits->bit[0]);
+}
+
+/* Subroutine: symbol_frame()
+ * Description: read back a whole bitmap row at once, like symbol_row()
+ * Input:
+ *  symbols: bitmap of the channel, or a copy of it
+ *  bit: number of symbols sliced into it, mod 2^16 (see cb_idx_bit)
+ *  back: how many samples before the last one is the first symbol
+ *  frame: the symbols, the first one in bit 0 of the first word
+ * Output: none
+ */
+forceinline void symbol_frame(uint64_t symbols[symbol_samples][bitmap_words], const uint16_t bit, const uint16_t back, uint64_t frame[bitmap_words]) {
+    uint16_t n = bit - 1 - back;
+    uint16_t column = (n / symbol_samples) & (bitmap_columns - 1);
+    const uint64_t *row = symbols[n % symbol_samples];
+    unsigned shift = column % 64, q;
+
+    for (q = 0; q < bitmap_words; q++) {
+        frame[q] = row[(column / 64 + q) % bitmap_words] >> shift;
+        if (shift)
+            frame[q] |= row[(column / 64 + q + 1) % bitmap_words] << (64 - shift);
+    }
+}
+
+/* Subroutine: packet_llr()
+ * Description: log-likelihood ratios of the bits of a packet, from their
+ *  soft decisions. The sliding sums are taken as Gaussian: the mean
+ *  magnitude of the decisions stands for the signal and their spread
+ *  around it for the noise. A clean packet gets the same large LLR on
+ *  every bit, a noisy one small and uneven ones, so that receptions of
+ *  different strength add up for what they are worth.
+ * Input:
+ *  soft: sliding sums of the channel, or a copy of them
+ *  bit: number of symbols sliced into them at the preamble match
+ *  bits: number of bits of the packet
+ *  llr: output, positive for "1"
+ * Output: none
+ */
+static void packet_llr(const int32_t soft[buffer_size], const uint16_t bit, const unsigned bits, float *llr) {
+    uint16_t n = bit - 1 - payload_back;
+    double sum = 0, square = 0, mean, variance;
+    unsigned i;
+
+    for (i = 0; i < bits; i++) {
+        llr[i] = soft_bit(soft, n, i);
+        sum += fabsf(llr[i]);
+        square += (double) llr[i] * llr[i];
+    }
+    mean = sum / bits;
+    variance = fmax(square / bits - mean * mean, mean * mean / 256);
+
+    for (i = 0; i < bits; i++)
+        llr[i] = variance > 0 ? fmaxf(fminf(2 * mean * llr[i] / variance, llr_max), -llr_max) : 0;
+}
+
+/* Subroutine: packet_symbol()
+ * Description: the symbol a packet was sent with, counting from the
+ *  first one of the preamble. Manchester coding sends each bit as itself
+ *  then its complement.
+ * Input:
+ *  packet: packet bytes
+ *  s: ordinal of the symbol
+ * Output: the symbol
+ */
+forceinline uint8_t packet_symbol(const uint8_t *packet, const unsigned s) {
+    unsigned i = (s - preamble_bits) / 2;
+
+    if (s < preamble_bits)
+        return preamble_pattern[s];
+    return ((packet[i / 8] >> (7 - i % 8)) & 1) ^ ((s - preamble_bits) & 1);
+}
+
+/* Subroutine: packet_toa()
+ * Description: time of arrival of a packet, to a fraction of a sample. The
+ *  match is only as good as the sample phase it happened at, up to half a
+ *  symbol off. But the sliding sum crosses zero half way between two
+ *  different symbols, that is in the middle of every Manchester-coded bit
+ *  and at most symbols of the preamble; linearly interpolated, each
+ *  crossing tells how far the match is from the middle of its symbols.
+ *  Crossings that noise moved by more than a quarter of a symbol from the
+ *  others are left out of their average.
+ * Input:
+ *  soft: sliding sums of the channel, or a copy of them
+ *  bit: number of symbols sliced into them at the preamble match
+ *  packet: packet bytes, as decoded
+ *  length: size of the packet
+ * Output: how many samples after the match the middle of the first
+ *  preamble symbol is, within half a symbol
+ */
+/* The sliding sums cross zero this many samples after the symbol edge that
+ * makes them: half the DFT window, plus half the sliding average. Seen from
+ * the middle of the first preamble symbol, its start is half a symbol more.
+ */
+#define toa_delay           ((dft_points - 1) / 2.f + (average_n - 1) / 2.f + symbol_samples / 2)
+
+static float packet_toa(const int32_t soft[buffer_size], const uint16_t bit, const uint8_t *packet, const uint16_t length) {
+    float offset[preamble_bits + max_packet_bytes * 16];
+    uint16_t n = bit - 1 - packet_samples;
+    unsigned s, j, count = 0, kept = 0, symbols = preamble_bits + length * 16;
+    float sum = 0, mean, toa = 0;
+
+    for (s = 0; s + 1 < symbols; s++) {
+        uint8_t a = packet_symbol(packet, s), b = packet_symbol(packet, s + 1);
+
+        if (a == b)
+            continue;
+        for (j = s * symbol_samples; j < (s + 1) * symbol_samples; j++) {
+            float x = soft[(uint16_t) (n + j) & (buffer_size - 1)];
+            float y = soft[(uint16_t) (n + j + 1) & (buffer_size - 1)];
+
+            if ((x > 0) == a && (y > 0) == b) {
+                offset[count] = j + x / (x - y) - s * symbol_samples - symbol_samples / 2;
+                sum += offset[count++];
+                break;
+            }
+        }
+    }
+    if (!count)
+        return 0;
+
+    mean = sum / count;
+    for (s = 0; s < count; s++) {
+        if (fabsf(offset[s] - mean) <= symbol_samples / 4) {
+            toa += offset[s];
+            kept++;
+        }
+    }
+    return kept ? toa / kept : mean;
+}
+
+/* Subroutine: packet_score()
+ * Description: how much to trust the bits of a packet: the LLRs give the
+ *  probability of each bit being wrong, and the score is 10 * log10 of
+ *  one over their sum, the expected number of wrong bits. Bits corrected
+ *  against their LLR count as the likely errors they were.
  * Input:
- *  packet: buffer with packet bytes
+ *  packet: packet bytes
  *  length: size of the packet
+ *  llr: LLR of each bit
+ * Output: the score, higher is better
+ */
+static int16_t packet_score(const uint8_t *packet, const uint16_t length, const float *llr) {
+    double wrong = 0;
+    unsigned i;
+
+    for (i = 0; i < length * 8u; i++)
+        wrong += 1 / (1 + exp((packet[i / 8] >> (7 - i % 8) & 1) ? llr[i] : -llr[i]));
+    return lrint(-10 * log10(wrong));
+}
+
+/* Subroutine: output()
+ * Description: hand a decoded packet over to the output callback, and stop
+ *  looking for preambles until it is over
+ * Input:
+ *  d: demodulator state
+ *  hits: the candidate the packet was found at
+ *  h: which of its matches
  *  channel: ordinal of the channel buffer
+ *  r: the packet
  * Output: none
  */
-void output(const uint8_t *packet, const uint16_t length, const uint8_t channel) {
-    uint16_t i, j;
-    char output[128], *p;
-    struct timespec  tv;
-    double rms;
-    uint64_t      timestamp;
+static void output(struct demod_state *d, const struct candidate_hits *hits, const uint8_t h, const uint8_t channel, const struct candidate_result *r) {
+    struct demod_frame frame;
+    uint64_t sample = hit_sample(hits, h);
+    float toa = r->toa - toa_delay;
 
-    for (i = 0, p = output; i < length; i++, p += 2)
-        snprintf(p, 3, "%02x", packet[i]);
+    frame.sample_index = sample - packet_samples + (int64_t) floorf(toa);
+    frame.sample_fraction = toa - floorf(toa);
+    frame.rms = hits->level[h] * (1 << level_shift) / (dft_points * dft_points);
+    frame.snr_db = hits->noise > 0 ? 10 * log10f(hits->level[h] / hits->noise) : 0;
+    frame.length = r->length;
+    frame.channel = channel;
+    frame.corrected_bits = r->corrected;
+    frame.receptions = r->receptions;
+    frame.score = packet_score(r->packet, r->length, r->llr);
+    memcpy(frame.packet, r->packet, r->length);
 
-    /* Since all the data was already in the buffer, compensate the timestamp
-     * subtracting the "time on the wire".
+    d->output(d->opaque, &frame);
+
+    /* Don't reprocess samples if we already decoded this as a valid message.
+     * This saves a lot of processing time, specially when dealing with busy
+     * channels.
      */
-    clock_gettime(NULL, &tv);
-    //gettimeofday(&tv, NULL);
-    timestamp = tv.tv_sec * 1e9 + tv.tv_nsec ;
-    timestamp -= (buffer_size / sample_rate) * 2;
+    atomic_store_explicit(&d->decoded_until[channel], sample + symbol_samples * 2 * (preamble_bits + r->length * 8) + 1, memory_order_relaxed);
+    d->stats.accepted[channel]++;
+    if (r->corrected)
+        d->stats.corrected[channel]++;
+    if (r->receptions > 1)
+        d->stats.combined[channel]++;
+}
 
-    double timestampdouble = (double) timestamp;
+/* Subroutine: candidate_decode()
+ * Description: attempt to decode the packet behind a preamble match
+ * Input:
+ *  config: demodulator settings
+ *  symbols: bitmap of the channel, or a copy of it
+ *  soft: sliding sums of the channel, or a copy of them
+ *  bit: number of symbols sliced into them at the match
+ *  fix_bits: how many wrong bits to correct through the CRC at most
+ *  r: output, the packet as far as it got
+ * Output: size of the packet, 0 if there is none
+ */
+static uint16_t candidate_decode(const struct demod_config *config, uint64_t symbols[symbol_samples][bitmap_words], const int32_t soft[buffer_size], const uint16_t bit, const uint8_t fix_bits, struct candidate_result *r) {
+    uint64_t frame[bitmap_words];
+    struct manchester_pairs first, second;
+    unsigned k, m, bytes = config->packet_bytes ? config->packet_bytes : max_packet_bytes;
+    uint16_t n = bit - 1 - payload_back;
+    uint16_t pairs, fix;
+    uint16_t crc16 = 0xffff;
+    uint8_t *packet = r->packet;
+    uint8_t data, valid;
 
-    /* "RMS" as in "Root Mean Square".
-     * Estimate the power of the signal we've just decoded.
+    /* When the preamble looks like valid, attempt to decode the rest of the
+     * packet. All the bits (including the preamble) are Manchester-coded.
+     * This means that the symbol values do not matter, only symbol transitions
+     * do encode the actual bits. For instance, "01" means "1", while "10" means
+     * "0". Both "00" and "11" are invalid, when one of these is detected, the
+     * bit is left to its soft decision: whichever of the two symbols stood out
+     * more. If there are too many invalid bits, probably the
+     * thing interpreted as preamble was a fluctuation in randomness, so we
+     * bail out. And yes, preamble is also Manchester-coded, in case you're
+     * wondering. nRF905 preamble is usually stated as having 10 bits. But
+     * Manchester-coded nRF905 preamble has 20 bits.
+     * The symbols of the packet follow each other in the bitmap row of the
+     * preamble, so a byte is 16 consecutive bits of it, and is decoded
+     * through manchester_table a nibble at a time.
      */
-    for (j = 0, rms = 0; j < packet_samples; j++)
-        rms += magnitude(cb_readn(iq, j));
-    rms /= packet_samples;
+    symbol_frame(symbols, bit, payload_back, frame);
+
+    r->corrected = 0;
+    r->bad_manchester = 0;
+    for (k = 0; k < bytes; k++) {
+        pairs = frame[k / 4] >> (k % 4 * 16);
+        first = manchester_table[pairs & 0xff];
+        second = manchester_table[pairs >> 8];
+        data = first.data << 4 | second.data;
+        valid = first.valid << 4 | second.valid;
+
+        /* Heuristic, bail out if too many bit encoding errors: more than
+         * half of the bits so far, at any of them.
+         */
+        if ((int) r->bad_manchester - (int) k * 4 > manchester_slack[valid]) {
+            r->bad_manchester = UINT16_MAX;
+            return 0;
+        }
+        r->bad_manchester += 8 - __builtin_popcount(valid);
+        packet[k] = data & valid;
+        for (m = 0; valid != 0xff && m < 8; m++) {
+            if (!(valid & (0x80 >> m)) && soft_bit(soft, n, k * 8 + m) > 0)
+                packet[k] |= 0x80 >> m;
+        }
 
+        /* Without a known packet size, look for a correct CRC after every
+         * 8-bit chunk, and output the packet bytes so far. It is quite
+         * possible that some incompletely processed packet appears to have
+         * a correct CRC.
+         */
+        if (!config->packet_bytes) {
+            crc16 = config->use_crc ? update_crc_ccitt(crc16, packet[k]) : 0;
+            if (crc16 == 0)
+                return k + 1;
+        }
+    }
 
-    struct modesMessage mm;
+    /* If the desired packet size is known/fixed and/or CRC is unavailable,
+     * it is possible to use packet size as the "packet received" condition.
+     */
+    if (!config->packet_bytes)
+        return 0;
+    if (!config->use_crc || !(crc16 = crc_ccitt(crc16, packet, bytes)))
+        return bytes;
 
-    mm.timestampMsg=timestamp;
-    mm.signalLevel=rms;
-    mm.msgbits=59*4;
+    /* A few wrong bits can be told from the CRC, see crc_syndrome. With
+     * up to 2 bits out of 232, most syndromes mean something, so noise
+     * would be "corrected" into packets just as often: only packets with
+     * no more bits skipped for bad Manchester than could be corrected are
+     * trusted that far.
+     */
+    if (fix_bits && bytes == max_packet_bytes && r->bad_manchester <= fix_bits) {
+        fix = crc_syndrome[crc16];
+        if (fix && fix != syndrome_ambiguous && (fix >> 8 ? 2 : 1) <= fix_bits) {
+            for (m = 0; m < 2 && (fix & 0xff); m++, fix >>= 8)
+                packet[((fix & 0xff) - 1) / 8] ^= 0x80 >> (((fix & 0xff) - 1) % 8);
+            r->corrected = m;
+            return bytes;
+        }
+    }
+    return 0;
+}
 
-    stringtobin(output,&mm.msg);
+/* Subroutine: candidate_combine()
+ * Description: retransmission combining. nRF905 resends the packets
+ *  (sometimes on different channels), and when no reception of a weak
+ *  packet makes it on its own, together they still may: the LLRs of a
+ *  reception that failed are kept in a slot keyed by its first bytes, and
+ *  the next reception with about the same key adds its own to them, until
+ *  the bits they decide on pass the CRC. Receptions less than a packet
+ *  apart are the same one, seen at another sample phase or leaking into
+ *  the next channel, and only the first one counts.
+ * Input:
+ *  combiner: the slots
+ *  sample: absolute index of the end of the reception
+ *  bytes: size of the packet
+ *  r: the reception, with its LLRs
+ * Output: whether the packet passes the CRC now, r then holds it
+ */
+static bool candidate_combine(struct demod_combiner *combiner, const uint64_t sample, const uint16_t bytes, struct candidate_result *r) {
+    struct combine_slot *slot, *found = NULL, *oldest = &combiner->slot[0];
+    uint64_t distance;
+    unsigned i, k, errors;
+    bool ok = false;
 
-    modesQueueOutput(&mm);
+    pthread_mutex_lock(&combiner->mutex);
+    for (i = 0; i < combine_slots && !found; i++) {
+        slot = &combiner->slot[i];
+        if (slot->receptions && sample > slot->sample + combine_window)
+            slot->receptions = 0;
+        if (!slot->receptions || (oldest->receptions && slot->sample < oldest->sample))
+            oldest = slot;
+        if (!slot->receptions)
+            continue;
 
+        for (k = 0, errors = 0; k < combine_key_bytes; k++)
+            errors += __builtin_popcount(slot->key[k] ^ r->packet[k]);
+        if (errors <= combine_key_errors)
+            found = slot;
+    }
 
-    /* 0x1a 0x40 Timestamp (6bytes) payload (29 bytes) !!! Escape 0x1a duplicate it */
-//    snprintf( output + i * 2, sizeof(output) + i * 2,
-//             "\t%.f\t%.01f\t%d",
-//             timestampdouble,
-//             20.0 * log10(sqrt(rms) / 181.019336), // almost certainly wrong
-//             channel + 117 // freq = (422.4 + (CH_NO / 10)) * (1 + HFREQ_PLL) MHz
-//    );
+    distance = found ? (sample > found->sample ? sample - found->sample : found->sample - sample) : 0;
+    if (!found) {
+        oldest->sample = sample;
+        oldest->receptions = 1;
+        memcpy(oldest->key, r->packet, combine_key_bytes);
+        memcpy(oldest->llr, r->llr, bytes * 8 * sizeof(float));
+    } else if (distance >= packet_samples && distance <= combine_window) {
+        memset(r->packet, 0, bytes);
+        for (i = 0; i < bytes * 8u; i++) {
+            r->llr[i] += found->llr[i];
+            if (r->llr[i] > 0)
+                r->packet[i / 8] |= 0x80 >> (i % 8);
+        }
 
+        if (!crc_ccitt(0xffff, r->packet, bytes)) {
+            r->receptions = found->receptions + 1;
+            found->receptions = 0;
+            ok = true;
+        } else {
+            found->sample = sample > found->sample ? sample : found->sample;
+            found->receptions++;
+            memcpy(found->key, r->packet, combine_key_bytes);
+            memcpy(found->llr, r->llr, bytes * 8 * sizeof(float));
+        }
+    }
+    pthread_mutex_unlock(&combiner->mutex);
+    return ok;
+}
 
+/* Subroutine: candidate_packet()
+ * Description: decode a candidate: its matches in order as they are, then
+ *  with bits corrected through the CRC (a match a symbol away often
+ *  decodes as it is), then the one with the fewest invalid Manchester
+ *  pairs combined with earlier receptions of the packet
+ * Input:
+ *  d: demodulator state
+ *  symbols: bitmap of the channel, or a copy of it
+ *  soft: sliding sums of the channel, or a copy of them
+ *  hits: the candidate
+ *  channel: ordinal of the channel
+ *  r: output, the packet
+ * Output: the match the packet was found at, hits->count if none
+ */
+static uint8_t candidate_packet(struct demod_state *d, uint64_t symbols[symbol_samples][bitmap_words], const int32_t soft[buffer_size], const struct candidate_hits *hits, const uint8_t channel, struct candidate_result *r) {
+    uint16_t bad = UINT16_MAX;
+    uint8_t h, fix, best = hits->count;
 
-    //char *message;
+    for (fix = 0; ; fix = d->config.fix_bits) {
+        for (h = 0; h < hits->count; h++) {
+            if (hit_sample(hits, h) < atomic_load_explicit(&d->decoded_until[channel], memory_order_relaxed))
+                continue;
+            if ((r->length = candidate_decode(&d->config, symbols, soft, hits->bit[h], fix, r))) {
+                r->receptions = 1;
+                packet_llr(soft, hits->bit[h], r->length * 8, r->llr);
+                r->toa = packet_toa(soft, hits->bit[h], r->packet, r->length);
+                return h;
+            }
+            if (r->bad_manchester < bad) {
+                bad = r->bad_manchester;
+                best = h;
+            }
+        }
+        if (fix == d->config.fix_bits)
+            break;
+    }
 
-    //message = "Hello Client , I have received your connection. But I have to go now, bye\n";
-    //message = "Hello Client , I have received your connection. But I have to go now, bye\n";
-    //write(Socket , output , strlen(output));
-    //puts(output);
-    //fflush(stdout);
+    /* Only complete packets of a known size can be combined, and only the
+     * CRC can tell when they are
+     */
+    if (!d->combiner || best == hits->count || !d->config.packet_bytes || !d->config.use_crc ||
+        d->config.packet_bytes < combine_key_bytes)
+        return hits->count;
+    candidate_decode(&d->config, symbols, soft, hits->bit[best], 0, r);
+    packet_llr(soft, hits->bit[best], d->config.packet_bytes * 8, r->llr);
+    if (!candidate_combine(d->combiner, hit_sample(hits, best), d->config.packet_bytes, r))
+        return hits->count;
+    r->length = d->config.packet_bytes;
+    r->toa = packet_toa(soft, hits->bit[best], r->packet, r->length);
+    return best;
+}
+
+/* Subroutine: candidate_close()
+ * Description: decode a candidate packet once no more matches can join it,
+ *  or queue it for the decoding threads if there are any. Then it is
+ *  their bursts of false preambles in noise that queue up, rather than the
+ *  samples behind them; when the pool runs out, the candidate is dropped.
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ * Output: none
+ */
+static void candidate_close(struct demod_state *d, const uint8_t channel) {
+    struct candidate_hits *hits = &d->hits[channel];
+    struct demod_pool *pool = d->pool;
+    struct demod_candidate *c;
+    struct candidate_result r;
+    uint8_t h;
+
+    d->stats.candidates[channel]++;
+
+    if (!pool) {
+        if ((h = candidate_packet(d, d->symbols[channel], d->soft[channel], hits, channel, &r)) < hits->count)
+            output(d, hits, h, channel, &r);
+        hits->count = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if ((c = pool->free)) {
+        pool->free = c->next;
+        memcpy(c->symbols, d->symbols[channel], sizeof(c->symbols));
+        memcpy(c->soft, d->soft[channel], sizeof(c->soft));
+        c->hits = *hits;
+        c->owner = d;
+        c->channel = channel;
+        c->next = NULL;
+        if (pool->tail)
+            pool->tail->next = c;
+        else
+            pool->head = c;
+        pool->tail = c;
+        pool->busy++;
+        pthread_cond_signal(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!c)
+        d->stats.dropped[channel]++;
+    hits->count = 0;
+}
+
+/* Subroutine: candidate_add()
+ * Description: record a preamble match. Matches less than a symbol apart
+ *  join the same candidate, the first one closes it when it comes later.
+ *  The symbols stay in the bitmap for long enough after that, so only
+ *  their position is kept for now.
+ * Input:
+ *  d: demodulator state
+ *  channel: ordinal of the channel
+ * Output: none
+ */
+forceinline void candidate_add(struct demod_state *d, const uint8_t channel) {
+    struct candidate_hits *hits = &d->hits[channel];
+
+    if (hits->count && d->sample_index - hits->sample >= symbol_samples) {
+        candidate_close(d, channel);
+        if (d->sample_index < atomic_load_explicit(&d->decoded_until[channel], memory_order_relaxed))
+            return;
+    }
+    if (!hits->count) {
+        hits->sample = d->sample_index;
+        hits->noise = noise_before(d, channel, d->sample_index - packet_samples);
+    }
+    hits->bit[hits->count] = d->cb_idx_bit[channel];
+    hits->level[hits->count++] = frame_level(d, channel);
 }
 
 /* Subroutine: bit_slicer()
- * Description: recover bits from the channel
+ * Description: recover bits from the channel, and look for preambles in them
  * Input:
- *  channel: up to 2 channels are supported for now
+ *  d: demodulator state
+ *  channel: index in the channel table
  *  amplitude: sample value
+ *  detect: whether to look for a packet ending here, or only keep track
+ *   of the symbols
  * Output: none
  */
-forceinline void bit_slicer(const uint8_t channel, const int32_t amplitude) {
-    /* Why is everything so "static"? As mentioned in the "forceinline"
-     * comment way above, these subroutines are not real subroutines. Thus we
-     * need to use "static" in order to preserve the buffer contents. Or use
-     * global variables.
-     * The best part is why the 'packet' buffer is also "static": nRF905
-     * resends the packets (sometimes on different channels). If we miss some
-     * bits on the first try, perhaps we manage to get them on the second
-     * attempt. Note that this is only possible because we differentiate
-     * "0" from "1" from "missing" during the decoding step!
-     */
-    static int32_t cb_buf_pcm[2][smooth_buffer_size];
-    static uint16_t cb_idx_pcm[2];
-    static uint8_t cb_buf_bit[2][buffer_size];
-    static uint16_t cb_idx_bit[2];
-    static int32_t sliding_sum[2];
-    static uint16_t skip_samples[2];
-    static uint8_t packet[max_packet_bytes];
-    uint16_t i, j, k;
-    uint16_t bad_manchester;
-    uint16_t crc16 = 0xffff;
+forceinline void bit_slicer(struct demod_state *d, const uint8_t channel, const int32_t amplitude, const bool detect) {
+    /* Everything that has to survive until the next sample lives in 'd'. */
+    int32_t *sliding_sum = d->sliding_sum;
+    uint32_t mismatch;
+    bool strobe;
 
     /* Simplest possible noise filter (at least, in software): sliding average.
      */
@@ -260,132 +1179,1013 @@ forceinline void bit_slicer(const uint8_t channel, const int32_t amplitude) {
      * However, these symbols are not bits yet: actual bits are encoded using
      * the Manchester coding.
      */
-    cb_write(bit[channel], sliding_sum[channel] > 0 ? 1 : 0);
+    symbol_write(d, channel, sliding_sum[channel]);
 
-    /* Don't reprocess samples if we already decoded this as a valid message.
-     * This saves a lot of processing time, specially when dealing with busy
-     * channels.
+    /* In symbol synchronous mode, only look for packets once per symbol, at
+     * the recovered symbol timing. Otherwise every sample phase gets its
+     * chance, which is 16 times the work but noticeably more sensitive:
+     * with weak signals, noise often spoils the recovered phase while a
+     * neighbouring one still decodes.
      */
-    if (skip_samples[channel]) {
-        skip_samples[channel]--;
+    strobe = (!d->config.symbol_sync || symbol_strobe(d, channel, sliding_sum[channel])) && detect;
+    if (!strobe || d->sample_index < atomic_load_explicit(&d->decoded_until[channel], memory_order_relaxed))
         return;
+
+    /* Attempt to match the preamble bit pattern. This is the hottest code
+     * path (most CPU-intensive), so all of its symbols are compared at once:
+     * they are consecutive in a bitmap row, and the number of mismatches is
+     * just the number of bits set in the XOR with the pattern. A few may be
+     * tolerated, the CRC is there to catch the false alarms.
+     */
+    mismatch = (symbol_row(d, channel, packet_samples) ^ d->preamble_word) & ((1U << preamble_bits) - 1);
+    if (mismatch && (!d->config.preamble_errors || __builtin_popcount(mismatch) > d->config.preamble_errors))
+        return;
+
+    candidate_add(d, channel);
+}
+
+/* Subroutine: dft_block_scalar()
+ * Description: transform the signal from time domain to frequency domain.
+ *  This is the reference DFT engine, the vector ones have to produce exactly
+ *  the same output.
+ * Input:
+ *  d: demodulator state
+ *  iq: n signed I/Q sample pairs
+ *  n: number of samples, up to DEMOD_BLOCK_SAMPLES
+ *  diff: per channel, space minus mark power for each sample
+ * Output: none
+ */
+static void dft_block_scalar(struct demod_state *d, const int8_t *iq, unsigned n, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES]) {
+    struct iq_sample raw, prev;
+    complex float sample, prev_sample;
+    uint16_t i;
+    unsigned k;
+    complex float *dft = d->dft;
+
+    for (k = 0; k < n; k++, iq += 2) {
+        /* Each raw I/Q ("In-Phase/Quadrature") sample pair from the RTL-SDR
+         * dongle is converted to one complex float. Samples are not normalized
+         * (meaning the values are not within the range [0,1]) because
+         * division is expensive.
+         */
+        raw.i = iq[0];
+        raw.q = iq[1];
+        cb_write(iq, raw);
+        __real__ sample = raw.i;
+        __imag__ sample = raw.q;
+
+        /* Compute the Discrete Fourier Transform for the last 'dft_points'
+         * samples. This works more-or-less like the moving average; instead
+         * of recalculating the entire thing for every 'dft_points' samples,
+         * we "add" the recent ones and "subtract" the oldest ones. Also, we
+         * don't compute the frequency bins for the frequencies we don't use,
+         * anyway.
+         * What kind of sorcery is this?! \(o_O)/
+         * Unfortunately, there's a downside: the frequency resolution is
+         * locked to the amount of samples per symbol. With Fast Fourier
+         * Transform, it is possible to apply some smart "window function" to
+         * overcome the resolution limitations. With Sliding DFT, the only
+         * practical window function is the rectangular one (AKA "none at
+         * all"). But, again, it is just enough to get the 100KHz resolution.
+         */
+        prev = cb_readn(iq, dft_points);
+        __real__ prev_sample = prev.i;
+        __imag__ prev_sample = prev.q;
+        for (i = 0; i < d->lanes; i++)
+            dft[i] = (dft[i] - prev_sample + sample) * d->coeffs[i];
+
+        /* For each channel, we subtract the power of signal at the mark
+         * frequency from the power of signal at the space frequency.
+         * This way, the noise floor (which is expected to be more-or-less the
+         * same at both frequencies) cancels out. It is feasible to use either
+         * mark or space frequencies alone, but that would require extra
+         * computation to tell signal apart from the noise floor.
+         */
+        for (i = 0; i < d->lanes; i += 2)
+            diff[i / 2][k] = magnitude(dft[i]) - magnitude(dft[i + 1]);
+    }
+}
+
+/* Subroutine: iq_block_write()
+ * Description: append a block of samples to the I/Q ring at once, for the
+ *  engines that go through the block more than once
+ * Input:
+ *  d: demodulator state
+ *  iq: n signed I/Q sample pairs
+ *  n: number of samples
+ * Output: ring index of the first sample of the block
+ */
+forceinline uint16_t iq_block_write(struct demod_state *d, const int8_t *iq, unsigned n) {
+    uint16_t first = d->cb_idx_iq;
+    struct iq_sample raw;
+    unsigned k;
+
+    for (k = 0; k < n; k++, iq += 2) {
+        raw.i = iq[0];
+        raw.q = iq[1];
+        cb_write(iq, raw);
+    }
+    return first;
+}
+
+#ifdef DEMOD_X86
+/* The vector engines keep 4 lanes (2 channels) as separate real and
+ * imaginary vectors and do every operation in the same order as
+ * dft_block_scalar(): subtract the oldest sample, add the newest, multiply
+ * by the coefficient, then square and subtract the magnitudes in double
+ * precision. The recursion itself can not be vectorized over time without
+ * changing the rounding, so each bin gets one vector lane instead.
+ * With more than 2 channels, the whole block goes through the first 4
+ * lanes, then through the next 4, and so on: each pass keeps its state in
+ * registers, so the cost per channel does not grow with the channel count.
+ */
+
+/* Subroutine: dft_block_sse2()
+ * Description: dft_block_scalar() with 4 bins at a time in SSE2 registers
+ */
+static void dft_block_sse2(struct demod_state *d, const int8_t *iq, unsigned n, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES]) {
+    struct iq_sample prev;
+    __m128 re, im, cre, cim, t_re, t_im;
+    __m128d re12, re34, im12, im34, m12, m34, delta;
+    __m128i out;
+    uint16_t first = iq_block_write(d, iq, n);
+    unsigned k, lane;
+
+    for (lane = 0; lane < d->lanes; lane += 4) {
+        complex float *dft = d->dft + lane, *coeffs = d->coeffs + lane;
+        int32_t *diff0 = diff[lane / 2], *diff1 = diff[lane / 2 + 1];
+
+        re  = _mm_setr_ps(crealf(dft[0]), crealf(dft[1]), crealf(dft[2]), crealf(dft[3]));
+        im  = _mm_setr_ps(cimagf(dft[0]), cimagf(dft[1]), cimagf(dft[2]), cimagf(dft[3]));
+        cre = _mm_setr_ps(crealf(coeffs[0]), crealf(coeffs[1]), crealf(coeffs[2]), crealf(coeffs[3]));
+        cim = _mm_setr_ps(cimagf(coeffs[0]), cimagf(coeffs[1]), cimagf(coeffs[2]), cimagf(coeffs[3]));
+
+        for (k = 0; k < n; k++) {
+            prev = d->cb_buf_iq[(first + k - dft_points) & cb_mask(iq)];
+
+            t_re = _mm_add_ps(_mm_sub_ps(re, _mm_set1_ps(prev.i)), _mm_set1_ps(iq[k * 2]));
+            t_im = _mm_add_ps(_mm_sub_ps(im, _mm_set1_ps(prev.q)), _mm_set1_ps(iq[k * 2 + 1]));
+            re = _mm_sub_ps(_mm_mul_ps(t_re, cre), _mm_mul_ps(t_im, cim));
+            im = _mm_add_ps(_mm_mul_ps(t_re, cim), _mm_mul_ps(t_im, cre));
+
+            re12 = _mm_cvtps_pd(re);
+            re34 = _mm_cvtps_pd(_mm_movehl_ps(re, re));
+            im12 = _mm_cvtps_pd(im);
+            im34 = _mm_cvtps_pd(_mm_movehl_ps(im, im));
+            m12 = _mm_add_pd(_mm_mul_pd(re12, re12), _mm_mul_pd(im12, im12));
+            m34 = _mm_add_pd(_mm_mul_pd(re34, re34), _mm_mul_pd(im34, im34));
+
+            // { |dft0|^2 - |dft1|^2, |dft2|^2 - |dft3|^2 }
+            delta = _mm_sub_pd(_mm_unpacklo_pd(m12, m34), _mm_unpackhi_pd(m12, m34));
+            out = _mm_cvttpd_epi32(delta);
+            diff0[k] = _mm_cvtsi128_si32(out);
+            diff1[k] = _mm_cvtsi128_si32(_mm_shuffle_epi32(out, 1));
+        }
+
+        dft[0] = CMPLXF(_mm_cvtss_f32(re), _mm_cvtss_f32(im));
+        dft[1] = CMPLXF(_mm_cvtss_f32(_mm_shuffle_ps(re, re, 1)), _mm_cvtss_f32(_mm_shuffle_ps(im, im, 1)));
+        dft[2] = CMPLXF(_mm_cvtss_f32(_mm_shuffle_ps(re, re, 2)), _mm_cvtss_f32(_mm_shuffle_ps(im, im, 2)));
+        dft[3] = CMPLXF(_mm_cvtss_f32(_mm_shuffle_ps(re, re, 3)), _mm_cvtss_f32(_mm_shuffle_ps(im, im, 3)));
+    }
+}
+
+/* Subroutine: dft_block_avx2()
+ * Description: dft_block_sse2() with the magnitudes of all 4 bins computed
+ *  in one AVX register. Built for AVX2 regardless of the compiler flags, and
+ *  only used when the CPU has it.
+ */
+__attribute__((target("avx2")))
+static void dft_block_avx2(struct demod_state *d, const int8_t *iq, unsigned n, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES]) {
+    struct iq_sample prev;
+    __m128 re, im, cre, cim, t_re, t_im;
+    __m256d re4, im4, m4;
+    __m128d delta;
+    __m128i out;
+    uint16_t first = iq_block_write(d, iq, n);
+    unsigned k, lane;
+
+    for (lane = 0; lane < d->lanes; lane += 4) {
+        complex float *dft = d->dft + lane, *coeffs = d->coeffs + lane;
+        int32_t *diff0 = diff[lane / 2], *diff1 = diff[lane / 2 + 1];
+
+        re  = _mm_setr_ps(crealf(dft[0]), crealf(dft[1]), crealf(dft[2]), crealf(dft[3]));
+        im  = _mm_setr_ps(cimagf(dft[0]), cimagf(dft[1]), cimagf(dft[2]), cimagf(dft[3]));
+        cre = _mm_setr_ps(crealf(coeffs[0]), crealf(coeffs[1]), crealf(coeffs[2]), crealf(coeffs[3]));
+        cim = _mm_setr_ps(cimagf(coeffs[0]), cimagf(coeffs[1]), cimagf(coeffs[2]), cimagf(coeffs[3]));
+
+        for (k = 0; k < n; k++) {
+            prev = d->cb_buf_iq[(first + k - dft_points) & cb_mask(iq)];
+
+            t_re = _mm_add_ps(_mm_sub_ps(re, _mm_set1_ps(prev.i)), _mm_set1_ps(iq[k * 2]));
+            t_im = _mm_add_ps(_mm_sub_ps(im, _mm_set1_ps(prev.q)), _mm_set1_ps(iq[k * 2 + 1]));
+            re = _mm_sub_ps(_mm_mul_ps(t_re, cre), _mm_mul_ps(t_im, cim));
+            im = _mm_add_ps(_mm_mul_ps(t_re, cim), _mm_mul_ps(t_im, cre));
+
+            re4 = _mm256_cvtps_pd(re);
+            im4 = _mm256_cvtps_pd(im);
+            m4 = _mm256_add_pd(_mm256_mul_pd(re4, re4), _mm256_mul_pd(im4, im4));
+
+            // { |dft0|^2, |dft2|^2, |dft1|^2, |dft3|^2 }
+            m4 = _mm256_permute4x64_pd(m4, _MM_SHUFFLE(3, 1, 2, 0));
+            delta = _mm_sub_pd(_mm256_castpd256_pd128(m4), _mm256_extractf128_pd(m4, 1));
+            out = _mm_cvttpd_epi32(delta);
+            diff0[k] = _mm_cvtsi128_si32(out);
+            diff1[k] = _mm_extract_epi32(out, 1);
+        }
+
+        dft[0] = CMPLXF(_mm_cvtss_f32(re), _mm_cvtss_f32(im));
+        dft[1] = CMPLXF(_mm_cvtss_f32(_mm_shuffle_ps(re, re, 1)), _mm_cvtss_f32(_mm_shuffle_ps(im, im, 1)));
+        dft[2] = CMPLXF(_mm_cvtss_f32(_mm_shuffle_ps(re, re, 2)), _mm_cvtss_f32(_mm_shuffle_ps(im, im, 2)));
+        dft[3] = CMPLXF(_mm_cvtss_f32(_mm_shuffle_ps(re, re, 3)), _mm_cvtss_f32(_mm_shuffle_ps(im, im, 3)));
+    }
+}
+#endif
+
+/* Subroutine: dft_block_int()
+ * Description: dft_block_scalar() in integer arithmetic only, for CPUs
+ *  without a (fast) FPU and for receivers that run forever.
+ *  The float engines multiply the whole running sum by the coefficient on
+ *  every sample, so their rounding errors pile up in it. Here, instead,
+ *  each sample is rotated on its own (by the twiddle factor for its position
+ *  in the 16-sample period, quantized to SDFT_Q bits) before going into the
+ *  sum. This is the "modulated" sliding DFT: the bins are rotated by a
+ *  different phase than the reference ones, which does not matter as we
+ *  only use their magnitude. A sample that is added now is subtracted
+ *  exactly 16 samples later with the same twiddle factor, and integer sums
+ *  cancel exactly, so the bins are always the exact sum of the last 16
+ *  rotated samples no matter how long we run.
+ *  Magnitudes are computed in 64 bits and scaled back to the units of the
+ *  float engines, so that the same thresholds work for both.
+ * Input:
+ *  d: demodulator state
+ *  iq: n signed I/Q sample pairs
+ *  n: number of samples, up to DEMOD_BLOCK_SAMPLES
+ *  diff: per channel, space minus mark power for each sample
+ * Output: none
+ */
+static void dft_block_int(struct demod_state *d, const int8_t *iq, unsigned n, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES]) {
+    struct iq_sample raw, prev;
+    int32_t *re = d->sdft_re, *im = d->sdft_im;
+    int64_t power[dft_lanes];
+    int16_t delta_i, delta_q;
+    unsigned k, b, phase = d->sdft_phase;
+
+    for (k = 0; k < n; k++, iq += 2) {
+        raw.i = iq[0];
+        raw.q = iq[1];
+        cb_write(iq, raw);
+        prev = cb_readn(iq, dft_points);
+
+        /* The bins are sums of 16 samples (|x| <= 128 * sqrt(2)) times
+         * twiddle factors (|t| <= 2^SDFT_Q), so they stay below 2^26 and
+         * their squares fit easily in 64 bits.
+         */
+        delta_i = raw.i - prev.i;
+        delta_q = raw.q - prev.q;
+        for (b = 0; b < d->lanes; b++) {
+            re[b] += delta_i * d->twiddle_re[b][phase] - delta_q * d->twiddle_im[b][phase];
+            im[b] += delta_i * d->twiddle_im[b][phase] + delta_q * d->twiddle_re[b][phase];
+            power[b] = (int64_t) re[b] * re[b] + (int64_t) im[b] * im[b];
+        }
+        phase = (phase + 1) & (dft_points - 1);
+
+        for (b = 0; b < d->lanes; b += 2)
+            diff[b / 2][k] = (power[b] - power[b + 1]) >> (SDFT_Q * 2);
     }
 
-    /* Attempt to match the preamble bit pattern. Bail out on the first
-     * discrepancy to spare CPU cycles. This is the hottest code path
-     * (most CPU-intensive).
+    d->sdft_phase = phase;
+}
+
+/* Subroutine: slice_block()
+ * Description: run the DFT engine output of one block through bit_slicer()
+ * Input:
+ *  d: demodulator state
+ *  diff: per channel, space minus mark power for each sample
+ *  n: number of samples
+ * Output: none
+ */
+forceinline void slice_block(struct demod_state *d, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES], unsigned n) {
+    uint64_t first = d->sample_index;
+    uint8_t channel;
+    bool detect;
+    unsigned k;
+
+    d->noise_sample[d->cb_idx_noise & (noise_history - 1)] = first;
+
+    /* The block goes through one channel after the other: the state of
+     * one channel at a time stays in the cache, however many there are.
+     * With more than one CPU, the channels can be spread over slicer
+     * threads instead, see slicer_dispatch().
      */
-    for (
-        i = packet_samples, j = 0;
-        j < preamble_bits;
-        i -= symbol_samples, j++
-    ) {
-        if (preamble_pattern[j] != cb_readn(bit[channel], i))
+    for (channel = 0; channel < d->config.channels; channel++) {
+        detect = squelch_block(d, channel, level_block(d, channel, diff[channel], n), n);
+
+        for (k = 0; k < n; k++) {
+            d->block_lag = n - 1 - k;
+            d->sample_index = first + k;
+            bit_slicer(d, channel, diff[channel][k], detect);
+        }
+
+        /* No match in the next block can join this candidate any more */
+        if (d->hits[channel].count && first + n - d->hits[channel].sample >= symbol_samples)
+            candidate_close(d, channel);
+    }
+
+    d->cb_idx_noise++;
+    d->sample_index = first + n;
+    d->stats.blocks++;
+}
+
+/* Subroutine: slicer_relax()
+ * Description: let the other hyperthread of the core run while polling
+ */
+forceinline void slicer_relax(void) {
+#ifdef DEMOD_X86
+    _mm_pause();
+#endif
+}
+
+/* Subroutine: slicer_wake()
+ * Description: wake up whoever sleeps on the ring, after moving its head or
+ *  tail. Both sides announce themselves in 'waiting' before they check the
+ *  ring for the last time (see slicer_wait()), and all of these accesses
+ *  are sequentially consistent, so either the sleeper sees the move, or
+ *  we see the sleeper.
+ * Input:
+ *  s: slicer
+ * Output: none
+ */
+static void slicer_wake(struct demod_slicer *s) {
+    if (!atomic_load(&s->waiting))
+        return;
+    pthread_mutex_lock(&s->mutex);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* Subroutine: slicer_wait()
+ * Description: wait for the other side to move the head or the tail of the
+ *  ring, or for the slicer to be stopped. Poll for a while, as with busy
+ *  channels the next block is usually about to come, then sleep.
+ * Input:
+ *  s: slicer
+ *  index: s->head or s->tail
+ *  seen: its last known value
+ * Output: none
+ */
+static void slicer_wait(struct demod_slicer *s, _Atomic uint32_t *index, uint32_t seen) {
+    unsigned spin;
+
+    for (spin = 0; spin < slicer_spins; spin++) {
+        if (atomic_load_explicit(index, memory_order_acquire) != seen || atomic_load(&s->stop))
             return;
+        slicer_relax();
     }
 
-    /* When the preamble looks like valid, attempt to decode the rest of the
-     * packet. All the bits (including the preamble) are Manchester-coded.
-     * This means that the symbol values do not matter, only symbol transitions
-     * do encode the actual bits. For instance, "01" means "1", while "10" means
-     * "0". Both "00" and "11" are invalid, when one of these is detected, the
-     * bit is skipped (and the bit from the previous decoding attempt for this
-     * position is used). If there are too many invalid bits, probably the
-     * thing interpreted as preamble was a fluctuation in randomness, so we
-     * bail out. And yes, preamble is also Manchester-coded, in case you're
-     * wondering. nRF905 preamble is usually stated as having 10 bits. But
-     * Manchester-coded nRF905 preamble has 20 bits.
-     */
-    bad_manchester = 0;
-    for (
-        i = packet_samples - preamble_bits * symbol_samples, j = 0;
-        i > symbol_samples;
-        i -= symbol_samples * 2, j++
-    ) {
-        k = j / 8;
-        if (cb_readn(bit[channel], i) != cb_readn(bit[channel], i + symbol_samples)) {
-            // valid Manchester
-            if (cb_readn(bit[channel], i)) {
-                // set to 1
-                packet[k] |=  (1 << (7 - (j & 7)));
-            } else {
-                // set to 0
-                packet[k] &= ~(1 << (7 - (j & 7)));
-            }
-        } else {
-            // heuristic, skip if too many bit encoding errors
-            if (++bad_manchester > j / 2)
-                return;
+    pthread_mutex_lock(&s->mutex);
+    atomic_fetch_add(&s->waiting, 1);
+    while (atomic_load(index) == seen && !atomic_load(&s->stop))
+        pthread_cond_wait(&s->cond, &s->mutex);
+    atomic_fetch_sub(&s->waiting, 1);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* Subroutine: slicer_output()
+ * Description: output callback of the slicer contexts: renumber the
+ *  channel, and hand the packet over to the demodulator's own callback, one
+ *  slicer at a time
+ * Input:
+ *  opaque: slicer
+ *  frame: the packet, on the slicer's channel
+ * Output: none
+ */
+static void slicer_output(void *opaque, const struct demod_frame *frame) {
+    struct demod_slicer *s = opaque;
+    struct demod_state *d = s->parent;
+    struct demod_frame f = *frame;
+
+    f.channel += s->first_channel;
+    pthread_mutex_lock(&d->output_mutex);
+    d->output(d->opaque, &f);
+    pthread_mutex_unlock(&d->output_mutex);
+}
+
+/* Subroutine: slicer_entry_point()
+ * Description: consumer side of a slicer ring. Every block goes through
+ *  slice_block() of the slicer context, as usual.
+ * Input:
+ *  arg: slicer
+ * Output: none
+ */
+static void *slicer_entry_point(void *arg) {
+    struct demod_slicer *s = arg;
+    struct demod_state *c = s->context;
+    struct slicer_block *block;
+    uint32_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed), head;
+
+    for (;;) {
+        while ((head = atomic_load_explicit(&s->head, memory_order_acquire)) == tail) {
+            if (atomic_load(&s->stop))
+                return NULL;
+            slicer_wait(s, &s->head, tail);
         }
 
-        /* At the end of every 8-bit chunk, update CRC checksum. When the
-         * checksum is (looks like) correct, proceed and output the packet
-         * bytes, regardless the packet size. It is quite possible that some
-         * incompletely processed packet appears to have a correct CRC.
-         * If the desired packet size is known/fixed and/or CRC is unavailable,
-         * it is possible to use packet size as the "packet received" condition.
-         */
-        if ((j & 7) == 7) {
-            crc16 = use_crc ? update_crc_ccitt(crc16, packet[k]) : 0;
-            k++;
-            if (crc16 == 0 && k == (packet_bytes ? packet_bytes : k)) {
-                output((const uint8_t *) packet, k, channel);
-                skip_samples[channel] = symbol_samples * 2 * (preamble_bits + k * 8);
-                /* memset((void *) packet, 0, sizeof(packet)); */
-                return;
-            }
+        for (; tail != head; tail++) {
+            block = (struct slicer_block *) (s->ring + (tail % DEMOD_RING_BLOCKS) * s->block_size);
+            c->sample_index = block->first;
+            slice_block(c, block->diff, block->n);
+
+            atomic_store(&s->tail, tail + 1);
+            slicer_wake(s);
         }
     }
 }
 
-/* Subroutine: sliding_dft()
- * Description: transform the signal from time domain to frequency domain
+/* Subroutine: slicer_dispatch()
+ * Description: producer side of the slicer rings, queue the DFT output of
+ *  one block for every slicer thread. When a ring is full, its slicer is
+ *  too slow: wait for it, rather than drop anything.
  * Input:
- *  i_sample: In-Phase component
- *  q_sample: Quadrature component
+ *  d: demodulator state
+ *  diff: per channel, space minus mark power for each sample
+ *  n: number of samples
  * Output: none
  */
-forceinline void sliding_dft(const int8_t i_sample, const int8_t q_sample) {
-    complex float sample, prev_sample;
-    uint16_t i;
-    static complex float dft[dft_points];
+static void slicer_dispatch(struct demod_state *d, int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES], unsigned n) {
+    struct demod_slicer *s;
+    struct slicer_block *block;
+    uint32_t head, tail, queued;
+    uint8_t t;
+
+    for (t = 0; t < d->nslicers; t++) {
+        s = &d->slicers[t];
+        head = atomic_load_explicit(&s->head, memory_order_relaxed);
+        while ((tail = atomic_load_explicit(&s->tail, memory_order_acquire)) == head - DEMOD_RING_BLOCKS)
+            slicer_wait(s, &s->tail, tail);
+
+        block = (struct slicer_block *) (s->ring + (head % DEMOD_RING_BLOCKS) * s->block_size);
+        block->first = d->sample_index;
+        block->n = n;
+        memcpy(block->diff, diff[s->first_channel], s->channels * sizeof(diff[0]));
+
+        queued = head + 1 - tail;
+        if (queued > s->high_water)
+            s->high_water = queued;
+        atomic_store(&s->head, head + 1);
+        if (queued >= slicer_wake_blocks)
+            slicer_wake(s);
+    }
+
+    d->sample_index += n;
+    d->stats.blocks++;
+}
+
+/* Subroutine: slicers_start()
+ * Description: split the channels among config.slicer_threads threads, each
+ *  with a demodulator context of its own for them, and start the threads
+ * Input:
+ *  d: demodulator state, with its settings
+ * Output: false if out of memory or the threads could not be started
+ */
+static bool slicers_start(struct demod_state *d) {
+    struct demod_config config;
+    struct demod_slicer *s;
+    pthread_attr_t attr;
+    uint8_t t, first, i;
+    bool ok;
+
+    if (posix_memalign((void **) &d->slicers, DEMOD_CACHE_LINE, d->config.slicer_threads * sizeof(*d->slicers)) != 0)
+        return false;
+    memset(d->slicers, 0, d->config.slicer_threads * sizeof(*d->slicers));
+    pthread_mutex_init(&d->output_mutex, NULL);
+
+    for (t = 0, first = 0; t < d->config.slicer_threads; t++) {
+        s = &d->slicers[t];
+        s->parent = d;
+        s->first_channel = first;
+        s->channels = (t + 1) * d->config.channels / d->config.slicer_threads - first;
+        first += s->channels;
+
+        config = d->config;
+        config.slicer_threads = 0;
+        config.decode_threads = 0;
+        config.combine = 0;
+        config.channels = s->channels;
+        for (i = 0; i < s->channels; i++)
+            config.channel[i] = d->config.channel[s->first_channel + i];
+
+        s->block_size = sizeof(struct slicer_block) + s->channels * sizeof(int32_t[DEMOD_BLOCK_SAMPLES]);
+        s->block_size = (s->block_size + DEMOD_CACHE_LINE - 1) & ~(size_t) (DEMOD_CACHE_LINE - 1);
+        if (!(s->context = demod_create(&config, slicer_output, s)) ||
+            posix_memalign((void **) &s->ring, DEMOD_CACHE_LINE, DEMOD_RING_BLOCKS * s->block_size) != 0) {
+            s->ring = NULL;
+            return false;
+        }
+        s->context->pool = d->pool;
+        s->context->combiner = d->combiner;
+
+        pthread_mutex_init(&s->mutex, NULL);
+        pthread_cond_init(&s->cond, NULL);
+
+        pthread_attr_init(&attr);
+#ifdef __linux__
+        if (d->config.slicer_cpu[t] >= 0) {
+            cpu_set_t cpus;
+
+            CPU_ZERO(&cpus);
+            CPU_SET(d->config.slicer_cpu[t], &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+#endif
+        ok = pthread_create(&s->thread, &attr, slicer_entry_point, s) == 0;
+        pthread_attr_destroy(&attr);
+        if (!ok)
+            return false;
+        d->nslicers++;
+    }
+    return true;
+}
+
+/* Subroutine: decoder_entry_point()
+ * Description: decoding thread, decode the candidates queued by
+ *  candidate_close() the same way it does without them. They come from
+ *  all the channels (and slicer contexts), so one decoder may be behind
+ *  another on the same channel: a packet found by both only goes out once.
+ * Input:
+ *  arg: pool
+ * Output: none
+ */
+static void *decoder_entry_point(void *arg) {
+    struct demod_pool *pool = arg;
+    struct demod_candidate *c;
+    struct demod_state *d;
+    struct candidate_result r;
+    uint8_t h;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->head && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        if (!(c = pool->head))
+            break;
+        if (!(pool->head = c->next))
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+
+        d = c->owner;
+        if ((h = candidate_packet(d, c->symbols, c->soft, &c->hits, c->channel, &r)) < c->hits.count) {
+            pthread_mutex_lock(&pool->output_mutex);
+            if (hit_sample(&c->hits, h) >= atomic_load(&d->decoded_until[c->channel]))
+                output(d, &c->hits, h, c->channel, &r);
+            pthread_mutex_unlock(&pool->output_mutex);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        c->next = pool->free;
+        pool->free = c;
+        if (!--pool->busy)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/* Subroutine: pool_start()
+ * Description: allocate the candidate pool and start config.decode_threads
+ *  decoding threads on it
+ * Input:
+ *  d: demodulator state, with its settings
+ * Output: false if out of memory or the threads could not be started
+ */
+static bool pool_start(struct demod_state *d) {
+    struct demod_pool *pool;
+    unsigned i;
+
+    if (!(pool = calloc(1, sizeof(*pool))))
+        return false;
+    d->pool = pool;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pthread_mutex_init(&pool->output_mutex, NULL);
+
+    if (posix_memalign((void **) &pool->candidates, DEMOD_CACHE_LINE, DEMOD_CANDIDATES * sizeof(*pool->candidates)) != 0) {
+        pool->candidates = NULL;
+        return false;
+    }
+    if (!(pool->threads = calloc(d->config.decode_threads, sizeof(*pool->threads))))
+        return false;
+    for (i = 0; i < DEMOD_CANDIDATES; i++) {
+        pool->candidates[i].next = pool->free;
+        pool->free = &pool->candidates[i];
+    }
+
+    for (i = 0; i < d->config.decode_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, decoder_entry_point, pool) != 0)
+            return false;
+        pool->nthreads++;
+    }
+    return true;
+}
+
+/* Subroutine: pool_wait()
+ * Description: wait until the decoding threads are done with every
+ *  candidate queued so far
+ * Input:
+ *  pool: pool
+ * Output: none
+ */
+static void pool_wait(struct demod_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->busy)
+        pthread_cond_wait(&pool->idle, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Subroutine: pool_stop()
+ * Description: let the decoding threads finish what is queued, stop them
+ *  and free the pool
+ * Input:
+ *  pool: pool
+ * Output: none
+ */
+static void pool_stop(struct demod_pool *pool) {
+    uint8_t t;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for (t = 0; t < pool->nthreads; t++)
+        pthread_join(pool->threads[t], NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->output_mutex);
+    free(pool->threads);
+    free(pool->candidates);
+    free(pool);
+}
+
+/* Subroutine: dft_engine_fn()
+ * Description: pick the implementation of a DFT engine
+ * Input:
+ *  engine: requested engine
+ * Output: the engine, or NULL if not available on this CPU
+ */
+static dft_block_fn dft_engine_fn(enum demod_dft_engine engine) {
+#ifdef DEMOD_X86
+    __builtin_cpu_init();
+#endif
+
+    switch (engine) {
+        case DEMOD_DFT_AUTO:
+#ifdef DEMOD_X86
+            if (__builtin_cpu_supports("avx2"))
+                return dft_block_avx2;
+            if (__builtin_cpu_supports("sse2"))
+                return dft_block_sse2;
+#endif
+            return dft_block_scalar;
+        case DEMOD_DFT_SCALAR:
+            return dft_block_scalar;
+        case DEMOD_DFT_INT:
+            return dft_block_int;
+#ifdef DEMOD_X86
+        case DEMOD_DFT_SSE2:
+            return __builtin_cpu_supports("sse2") ? dft_block_sse2 : NULL;
+        case DEMOD_DFT_AVX2:
+            return __builtin_cpu_supports("avx2") ? dft_block_avx2 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+int demod_dft_engine_supported(enum demod_dft_engine engine) {
+    return dft_engine_fn(engine) != NULL;
+}
+
+void demod_default_config(struct demod_config *config) {
+    uint8_t i;
 
-    /* Each raw I/Q ("In-Phase/Quadrature") sample pair from the RTL-SDR dongle
-     * is stored as one complex float. Samples are not normalized (meaning the
-     * values are not within the range [0,1]) because division is expensive.
+    config->packet_bytes = 0;
+    config->use_crc = 1;
+    config->dft_engine = DEMOD_DFT_AUTO;
+    config->preamble_errors = 0;
+    config->symbol_sync = 0;
+    config->squelch_db = 0;
+    config->channels = 2;
+    config->channel[0] = (struct demod_channel) { 1, 2 };  // 868.2MHz
+    config->channel[1] = (struct demod_channel) { 3, 4 };  // 868.4MHz
+    config->slicer_threads = 0;
+    for (i = 0; i < DEMOD_MAX_CHANNELS; i++)
+        config->slicer_cpu[i] = -1;
+    config->decode_threads = 0;
+    config->fix_bits = 0;
+    config->combine = 1;
+}
+
+/* Subroutine: tables_init()
+ * Description: fill the Manchester tables, once per process
+ */
+static void tables_init(void) {
+    unsigned x, m, invalid;
+    int slack;
+
+    for (x = 0; x < 256; x++) {
+        for (m = 0; m < 4; m++) {
+            manchester_table[x].data |= ((x >> (m * 2)) & 1) << (3 - m);
+            manchester_table[x].valid |= (((x >> (m * 2)) ^ (x >> (m * 2 + 1))) & 1) << (3 - m);
+        }
+
+        for (m = 0, invalid = 0, slack = INT8_MAX; m < 8; m++) {
+            if (!(x & (0x80 >> m)) && (int) (m / 2) - (int) ++invalid < slack)
+                slack = m / 2 - invalid;
+        }
+        manchester_slack[x] = slack;
+    }
+}
+
+/* Subroutine: syndrome_init()
+ * Description: fill crc_syndrome, once per process and only if needed:
+ *  it takes a few ms
+ */
+static void syndrome_init(void) {
+    uint16_t single[max_packet_bytes * 8], syndrome, *fix;
+    uint8_t packet[max_packet_bytes];
+    unsigned i, j;
+
+    for (i = 0; i < max_packet_bytes * 8; i++) {
+        memset(packet, 0, sizeof(packet));
+        packet[i / 8] = 0x80 >> (i % 8);
+        single[i] = crc_ccitt(0, packet, sizeof(packet));
+        crc_syndrome[single[i]] = i + 1;
+    }
+
+    /* Single errors never share a syndrome with anything else (that would
+     * take packets 3 bits apart with the same CRC)
      */
-    __real__ sample = i_sample;
-    __imag__ sample = q_sample;
-    cb_write(iq, sample);
-
-    /* Compute the Discrete Fourier Transform for the last 'dft_points' samples.
-     * This works more-or-less like the moving average; instead of recalculating
-     * the entire thing for every 'dft_points' samples, we "add" the recent ones
-     * and "subtract" the oldest ones. Also, we don't compute the frequency bins
-     * for the frequencies we don't use, anyway.
-     * What kind of sorcery is this?! \(o_O)/
-     * Unfortunately, there's a downside: the frequency resolution is locked
-     * to the amount of samples per symbol. With Fast Fourier Transform, it is
-     * possible to apply some smart "window function" to overcome the resolution
-     * limitations. With Sliding DFT, the only practical window function is the
-     * rectangular one (AKA "none at all"). But, again, it is just enough to
-     * get the 100KHz resolution.
+    for (i = 0; i < max_packet_bytes * 8; i++) {
+        for (j = i + 1; j < max_packet_bytes * 8; j++) {
+            syndrome = single[i] ^ single[j];
+            fix = &crc_syndrome[syndrome];
+            if (!*fix)
+                *fix = (i + 1) | (j + 1) << 8;
+            else if (*fix >> 8)
+                *fix = syndrome_ambiguous;
+        }
+    }
+}
+
+struct demod_state *demod_create(const struct demod_config *config, demod_output_fn output, void *opaque) {
+    struct demod_state *d;
+    uint8_t bin[dft_lanes];
+    uint16_t i, b;
+
+    if (!dft_engine_fn(config->dft_engine) || config->preamble_errors > DEMOD_MAX_PREAMBLE_ERRORS ||
+        !(config->squelch_db >= 0) || config->fix_bits > DEMOD_MAX_FIX_BITS)
+        return NULL;
+
+    /* Bin 0 is allowed: what is at DC depends on what feeds us, keeping
+     * channels off a dongle's own offset is up to the caller.
      */
-    prev_sample = cb_readn(iq, dft_points);
-    for (i = 1; i <= 4; i++)
-        dft[i] = (dft[i] - prev_sample + sample) * coeffs[i];
-
-    /* TODO: implement threads.
-     * Now that the channels are separated, each one can be handled by
-     * a different CPU. If only we have more than one CPU.
-     * How this works: for each channel, we subtract the power of signal at
-     * the mark frequency from the power of signal at the space frequency.
-     * This way, the noise floor (which is expected to be more-or-less the same
-     * at both frequencies) cancels out. It is feasible to use either mark
-     * or space frequencies alone, but that would require extra computation
-     * to tell signal apart from the noise floor.
+    if (config->channels < 1 || config->channels > DEMOD_MAX_CHANNELS || config->slicer_threads > config->channels ||
+        config->decode_threads > DEMOD_MAX_DECODE_THREADS)
+        return NULL;
+    memset(bin, 0, sizeof(bin));
+    for (i = 0; i < config->channels; i++) {
+        const struct demod_channel *c = &config->channel[i];
+
+        if (c->space_bin >= dft_points || c->mark_bin >= dft_points || c->space_bin == c->mark_bin)
+            return NULL;
+        bin[i * 2] = c->space_bin;
+        bin[i * 2 + 1] = c->mark_bin;
+    }
+
+    pthread_once(&tables_once, tables_init);
+    if (config->fix_bits)
+        pthread_once(&syndrome_once, syndrome_init);
+    if (posix_memalign((void **) &d, DEMOD_CACHE_LINE, sizeof(*d)) != 0)
+        return NULL;
+    d->slicers = NULL;
+    d->nslicers = 0;
+    d->pool = NULL;
+    d->combiner = NULL;
+    d->config = *config;
+    memset(d->hits, 0, sizeof(d->hits));
+
+    demod_reset(d, 0);
+    d->dft_block = dft_engine_fn(config->dft_engine);
+
+    for (i = 0, d->preamble_word = 0; i < preamble_bits; i++)
+        d->preamble_word |= (uint32_t) preamble_pattern[i] << i;
+    d->output = output;
+    d->opaque = opaque;
+    memset(&d->stats, 0, sizeof(d->stats));
+
+    d->squelch_open = powf(10.f, config->squelch_db / 10.f);
+    d->squelch_close = powf(10.f, fmaxf(config->squelch_db - squelch_hysteresis_db, 0.f) / 10.f);
+
+    /* Pre-compute the DFT coefficients, for the bin of each lane */
+    d->lanes = (config->channels * 2 + 3) & ~3;
+    for (b = 0; b < dft_lanes; b++)
+        d->coeffs[b] = cexp(I * 2. * M_PI * bin[b] / dft_points);
+
+    /* And the fixed point ones of dft_block_int() */
+    for (b = 0; b < dft_lanes; b++) {
+        for (i = 0; i < dft_points; i++) {
+            d->twiddle_re[b][i] = lround(cos(-2. * M_PI * bin[b] * i / dft_points) * (1 << SDFT_Q));
+            d->twiddle_im[b][i] = lround(sin(-2. * M_PI * bin[b] * i / dft_points) * (1 << SDFT_Q));
+        }
+    }
+
+    if (config->combine) {
+        if (!(d->combiner = calloc(1, sizeof(*d->combiner)))) {
+            demod_destroy(d);
+            return NULL;
+        }
+        pthread_mutex_init(&d->combiner->mutex, NULL);
+    }
+
+    /* The slicer contexts queue their candidates in the same pool */
+    if ((config->decode_threads && !pool_start(d)) || (config->slicer_threads && !slicers_start(d))) {
+        demod_destroy(d);
+        return NULL;
+    }
+    return d;
+}
+
+void demod_reset(struct demod_state *d, uint64_t sample_index) {
+    uint8_t t;
+
+    /* The slicers are idle once flushed, their contexts can be reset from
+     * here
      */
-    bit_slicer(0, magnitude(dft[1]) - magnitude(dft[2])); // power at bins 1 & 2
-    bit_slicer(1, magnitude(dft[3]) - magnitude(dft[4])); // power at bins 3 & 4
+    demod_flush(d);
+    for (t = 0; t < d->nslicers; t++)
+        demod_reset(d->slicers[t].context, sample_index);
+
+    memset(d->dft, 0, sizeof(d->dft));
+    memset(d->sdft_re, 0, sizeof(d->sdft_re));
+    memset(d->sdft_im, 0, sizeof(d->sdft_im));
+    d->sdft_phase = 0;
+    memset(d->cb_buf_iq, 0, sizeof(d->cb_buf_iq));
+    d->cb_idx_iq = 0;
+    memset(d->cb_buf_level, 0, sizeof(d->cb_buf_level));
+    memset(d->cb_idx_level, 0, sizeof(d->cb_idx_level));
+    d->block_lag = 0;
+
+    memset(d->cb_buf_pcm, 0, sizeof(d->cb_buf_pcm));
+    memset(d->cb_idx_pcm, 0, sizeof(d->cb_idx_pcm));
+    memset(d->symbols, 0, sizeof(d->symbols));
+    memset(d->cb_idx_bit, 0, sizeof(d->cb_idx_bit));
+    memset(d->sliding_sum, 0, sizeof(d->sliding_sum));
+    memset(d->soft, 0, sizeof(d->soft));
+    memset(d->eye, 0, sizeof(d->eye));
+    memset(d->strobe_countdown, symbol_samples, sizeof(d->strobe_countdown));
+    for (t = 0; t < DEMOD_MAX_CHANNELS; t++)
+        atomic_store(&d->decoded_until[t], sample_index);
+    memset(d->noise_floor, 0, sizeof(d->noise_floor));
+    memset(d->cb_buf_noise, 0, sizeof(d->cb_buf_noise));
+    memset(d->noise_sample, 0, sizeof(d->noise_sample));
+    d->cb_idx_noise = 0;
+    memset(d->squelch_hang, 0, sizeof(d->squelch_hang));
+    if (d->combiner) {
+        pthread_mutex_lock(&d->combiner->mutex);
+        memset(d->combiner->slot, 0, sizeof(d->combiner->slot));
+        pthread_mutex_unlock(&d->combiner->mutex);
+    }
+
+    d->sample_index = sample_index;
+}
+
+void demod_feed(struct demod_state *d, const int8_t *iq, size_t n) {
+    int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES] __attribute__((aligned(DEMOD_CACHE_LINE)));
+
+    while (n) {
+        unsigned len = n < DEMOD_BLOCK_SAMPLES ? n : DEMOD_BLOCK_SAMPLES;
+
+        d->dft_block(d, iq, len, diff);
+        if (d->nslicers)
+            slicer_dispatch(d, diff, len);
+        else
+            slice_block(d, diff, len);
+        iq += len * 2;
+        n -= len;
+    }
 }
 
+void demod_feed_cu8(struct demod_state *d, const uint8_t *iq, size_t n) {
+    int32_t diff[dft_lanes / 2][DEMOD_BLOCK_SAMPLES] __attribute__((aligned(DEMOD_CACHE_LINE)));
+    int8_t block[DEMOD_BLOCK_SAMPLES * 2];
+    unsigned i;
+
+    while (n) {
+        unsigned len = n < DEMOD_BLOCK_SAMPLES ? n : DEMOD_BLOCK_SAMPLES;
+
+        /* Converting a block at a time keeps the DFT engines single-format,
+         * and costs nothing next to them: it stays in L1. 255 - 127 does not
+         * fit in an int8_t, it is clamped to 127 rather than wrapped to -128.
+         */
+        for (i = 0; i < len * 2; i++)
+            block[i] = (iq[i] < 255 ? iq[i] : 254) - 127;
+
+        d->dft_block(d, block, len, diff);
+        if (d->nslicers)
+            slicer_dispatch(d, diff, len);
+        else
+            slice_block(d, diff, len);
+        iq += len * 2;
+        n -= len;
+    }
+}
+
+void demod_flush(struct demod_state *d) {
+    struct demod_slicer *s;
+    uint32_t head, tail;
+    uint8_t t, i;
+
+    for (t = 0; t < d->nslicers; t++) {
+        s = &d->slicers[t];
+        head = atomic_load_explicit(&s->head, memory_order_relaxed);
+
+        // Whatever is queued may not have been worth waking it up for yet
+        slicer_wake(s);
+        while ((tail = atomic_load_explicit(&s->tail, memory_order_acquire)) != head)
+            slicer_wait(s, &s->tail, tail);
+
+        // Idle now, its candidates can be closed from here
+        demod_flush(s->context);
+    }
+
+    for (i = 0; i < d->config.channels; i++) {
+        if (d->hits[i].count)
+            candidate_close(d, i);
+    }
+    if (d->pool && d->config.decode_threads)
+        pool_wait(d->pool);
+}
+
+uint64_t demod_sample_index(const struct demod_state *d) {
+    return d->sample_index;
+}
+
+void demod_get_stats(const struct demod_state *d, struct demod_stats *stats) {
+    const struct demod_slicer *s;
+    uint8_t t, i;
+
+    *stats = d->stats;
+    for (t = 0; t < d->nslicers; t++) {
+        s = &d->slicers[t];
+        for (i = 0; i < s->channels; i++) {
+            stats->squelched[s->first_channel + i] = s->context->stats.squelched[i];
+            stats->ring_high_water[s->first_channel + i] = s->high_water;
+            stats->candidates[s->first_channel + i] = s->context->stats.candidates[i];
+            stats->accepted[s->first_channel + i] = s->context->stats.accepted[i];
+            stats->dropped[s->first_channel + i] = s->context->stats.dropped[i];
+            stats->corrected[s->first_channel + i] = s->context->stats.corrected[i];
+            stats->combined[s->first_channel + i] = s->context->stats.combined[i];
+        }
+    }
+}
+
+void demod_destroy(struct demod_state *d) {
+    struct demod_slicer *s;
+    uint8_t t;
+
+    if (!d)
+        return;
+
+    /* Let the slicers and the decoders finish what they have, then stop
+     * them
+     */
+    demod_flush(d);
+    for (t = 0; t < d->nslicers; t++) {
+        s = &d->slicers[t];
+        pthread_mutex_lock(&s->mutex);
+        atomic_store(&s->stop, true);
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+        pthread_join(s->thread, NULL);
+        pthread_mutex_destroy(&s->mutex);
+        pthread_cond_destroy(&s->cond);
+    }
+
+    if (d->slicers) {
+        for (t = 0; t < d->config.slicer_threads; t++) {
+            demod_destroy(d->slicers[t].context);
+            free(d->slicers[t].ring);
+        }
+        free(d->slicers);
+        pthread_mutex_destroy(&d->output_mutex);
+    }
+    if (d->pool && d->config.decode_threads)
+        pool_stop(d->pool);
+    if (d->combiner && d->config.combine) {
+        pthread_mutex_destroy(&d->combiner->mutex);
+        free(d->combiner);
+    }
+    free(d);
+}
@@ -0,0 +1,214 @@
+/* nrf905_demod, demodulator for nRF905 Single chip 433/868/915MHz Transceiver
+ * Copyright (C) 2014 Stanislaw Pusep
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NRF905_DEMOD_H
+#define NRF905_DEMOD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* "Magic" constants... These come directly or indirectly from the nRF905
+ * specification. Here is a simplified explanation about how this program works.
+ * First of all, nRF905 sends two kinds of pulses: mark & space. Mark means "1"
+ * symbol and space means "0" (or vice-versa; who cares, more on this later).
+ * If you tune nRF905 to use 868.2MHz (AKA "channel 117"), space is sent at a
+ * slightly lower frequency (868.15MHz) while mark is sent at a slightly higher
+ * one (868.25MHz). There's nothing interesting at exactly 868.2MHz (at least,
+ * not for this program). So, fact #1: there's 100KHz separation between mark
+ * & space.
+ * Then, enter the sample rate. If we read 1 million of samples every second
+ * (1MHz sample rate) each symbol (and therefore, mark/space pulse) will be
+ * spread across just 10 samples. This means that we only have a serie of
+ * 10 values to figure out the frequency. By the way, this serie is in
+ * "time domain". Fourier transform turns it into "frequency domain".
+ * But for 10 input values, it will produce 10 output values.
+ * Thus, 10 samples => 10 frequencies. Which frequencies? Intuitively enough,
+ * our 1MHz sample rate is equally split in 10 "bins" spaced by 100KHz.
+ * Fact #2: each symbol has just enough samples to make it possible to
+ * discriminate mark/space. Which means that we can tune to 868.15MHz, and
+ * "bin 0" will filter our spaces, and "bin 1" will filter our marks...
+ * Except we can not use "bin 0", because it is somewhat special (DC).
+ * Instead, we tune to 868.05MHz and get "bin 1" as space and "bin 2" as mark.
+ * Then we get "bin 3" and "bin 4" as space & mark for the next channel
+ * (868.4MHz, AKA "channel 118"). And perhaps the next channel... And so on
+ * until "bin 6", which wraps and gets us a "negative frequency" (that is,
+ * something below 868.05MHz that we're tuned to). Let's not talk about bins
+ * 6-10 for now. (Now we do: see struct demod_channel.)
+ * Finally, fact #3: computers are not impressed when we round up our
+ * arithmetics to 10, they prefer 16. That's why the sampling rate is 1.6MHz
+ * and we have 16 samples per symbol.
+ */
+#define symbol_samples      (16)
+#define symbol_rate         (100000)
+#define max_packet_bytes    (29)
+#define preamble_bits       (20)
+#define packet_samples      (symbol_samples * 2 * (preamble_bits + max_packet_bytes * 8))
+#define dft_points          (symbol_samples)
+#define sample_rate         (symbol_rate * symbol_samples)
+#define buffer_size         (1 << 13)
+#define smooth_buffer_size  (1 << 3)
+#define average_n           (7)
+
+/* Demodulator contexts are aligned (and padded) to this, so that contexts
+ * used by different threads never share a cache line.
+ */
+#define DEMOD_CACHE_LINE    (64)
+
+/* Implementations of the sliding DFT. The floating point ones all give
+ * identical results, the scalar one is the reference for the others.
+ */
+enum demod_dft_engine {
+    DEMOD_DFT_AUTO,                  // Fastest one this CPU supports
+    DEMOD_DFT_SCALAR,
+    DEMOD_DFT_SSE2,
+    DEMOD_DFT_AVX2,
+    DEMOD_DFT_INT                    // Integer only, close to (not the same as) the others
+};
+
+/* Each channel takes two bins, and straight from a dongle bin 0 (DC) is of
+ * no use
+ */
+#define DEMOD_MAX_CHANNELS  ((dft_points - 1) / 2)
+
+/* One channel, as the DFT bins of its space and mark frequencies. Bin b is
+ * b * 100KHz above the tuned frequency, and the ones past dft_points / 2
+ * wrap around to below it: 868.2MHz is bins 1 & 2, 867.8MHz bins 13 & 14.
+ */
+struct demod_channel {
+    uint8_t space_bin;
+    uint8_t mark_bin;
+};
+
+/* The preamble has 10 "1" symbols: with more errors allowed, silence
+ * would already look like one.
+ */
+#define DEMOD_MAX_PREAMBLE_ERRORS (4)
+
+/* With slicer threads, blocks of DFT output wait for them in rings of this
+ * many blocks
+ */
+#define DEMOD_RING_BLOCKS   (128)
+
+/* With decoding threads, candidate packets (preamble matches) wait for them
+ * in a pool of this many. When it runs out, new ones are dropped.
+ */
+#define DEMOD_CANDIDATES    (128)
+#define DEMOD_MAX_DECODE_THREADS (16)
+
+/* Packets of max_packet_bytes with a bad CRC can have up to this many bits
+ * corrected, see demod_config.fix_bits
+ */
+#define DEMOD_MAX_FIX_BITS  (2)
+
+/* Demodulator settings, fixed for the lifetime of a context. Fill with
+ * demod_default_config() and then change what is needed.
+ */
+struct demod_config {
+    uint8_t packet_bytes;            // Expected packet size, 0 for "whatever passes the CRC"
+    uint8_t use_crc;                 // Use the CRC as the "packet received" condition
+    enum demod_dft_engine dft_engine;
+    uint8_t preamble_errors;         // Preamble symbols allowed to mismatch, up to DEMOD_MAX_PREAMBLE_ERRORS
+    uint8_t symbol_sync;             // Look for packets once per symbol at the recovered timing, not at every sample
+    float   squelch_db;              // Only look for packets where the signal is this far above the noise floor, 0 to look everywhere
+    uint8_t channels;                // Number of channels to demodulate, up to DEMOD_MAX_CHANNELS
+    struct demod_channel channel[DEMOD_MAX_CHANNELS];
+    uint8_t slicer_threads;          // Slice the channels on this many threads of their own (up to one per channel), 0 to slice them in the feeding thread
+    int16_t slicer_cpu[DEMOD_MAX_CHANNELS]; // CPU to pin each slicer thread to, -1 for any (pinning is only supported on Linux)
+    uint8_t decode_threads;          // Decode candidate packets on this many threads of their own (up to DEMOD_MAX_DECODE_THREADS), 0 to decode them where they are found
+    uint8_t fix_bits;                // Correct up to this many wrong bits (up to DEMOD_MAX_FIX_BITS) in packets of packet_bytes == max_packet_bytes with a bad CRC, 0 for none
+    uint8_t combine;                 // Combine receptions of a packet that fail on their own with its resends, only with packet_bytes and use_crc
+};
+
+/* Counters, for the curious */
+struct demod_stats {
+    uint64_t blocks;                 // Blocks demodulated
+    uint64_t squelched[DEMOD_MAX_CHANNELS]; // Per channel, blocks where no packet could end, and that were not looked into
+    uint32_t ring_high_water[DEMOD_MAX_CHANNELS]; // Per channel, most blocks ever queued for the slicer thread it is on, up to DEMOD_RING_BLOCKS
+    uint64_t candidates[DEMOD_MAX_CHANNELS]; // Per channel, candidate packets: preamble matches, those within a symbol of each other counted once
+    uint64_t accepted[DEMOD_MAX_CHANNELS];   // Of those, the ones that turned out to be packets
+    uint64_t dropped[DEMOD_MAX_CHANNELS];    // And the ones that found the candidate pool full, and were not decoded
+    uint64_t corrected[DEMOD_MAX_CHANNELS];  // Accepted packets that had bits corrected
+    uint64_t combined[DEMOD_MAX_CHANNELS];   // And the ones combined from several receptions
+};
+
+/* One decoded packet, as handed to the output callback */
+struct demod_frame {
+    uint64_t sample_index;           // Absolute index of the first sample of the preamble
+    float    sample_fraction;        // Time of arrival past sample_index, 0 to 1 sample
+    double   rms;                    // Mean power of the channel over the packet, unnormalized I/Q units
+    float    snr_db;                 // Over the noise floor of the channel
+    uint16_t length;                 // Number of valid bytes in packet
+    uint8_t  channel;                // Index in demod_config.channel of the channel it was received on
+    uint8_t  corrected_bits;         // Bits corrected through the CRC, up to demod_config.fix_bits
+    uint8_t  receptions;             // Receptions it was combined from, 1 if it made it on its own
+    int16_t  score;                  // Confidence in the bits, 10 * log10 of one over the expected number of wrong ones
+    uint8_t  packet[max_packet_bytes];
+};
+
+/* Called for every decoded packet. The frame is only valid for the duration
+ * of the call. With slicer or decoding threads, it is called from them, but
+ * never from two at the same time, and with several decoding threads
+ * packets may come out of order.
+ */
+typedef void (*demod_output_fn)(void *opaque, const struct demod_frame *frame);
+
+struct demod_state;
+
+void demod_default_config(struct demod_config *config);
+
+/* Whether the engine was built in and runs on this CPU */
+int demod_dft_engine_supported(enum demod_dft_engine engine);
+
+/* Allocate a demodulator, and start its slicer threads if any. Returns NULL
+ * when out of memory, or when the settings are not supported. Each context is
+ * completely independent of the others, so any number of them can be fed
+ * concurrently as long as every one is only used by one thread at a time.
+ */
+struct demod_state *demod_create(const struct demod_config *config, demod_output_fn output, void *opaque);
+
+/* Forget all the signal history, and number the next sample fed as
+ * sample_index. Waits for the slicer threads to be done first.
+ */
+void demod_reset(struct demod_state *d, uint64_t sample_index);
+
+/* Demodulate n signed 8-bit I/Q sample pairs (IQIQIQ...). With slicer
+ * threads, this returns once the DFT is done, and the packets come later.
+ */
+void demod_feed(struct demod_state *d, const int8_t *iq, size_t n);
+
+/* Same, for unsigned 8-bit pairs as they come from RTL-SDR dongles (127
+ * is zero). Converted on the fly, without a copy of the block.
+ */
+void demod_feed_cu8(struct demod_state *d, const uint8_t *iq, size_t n);
+
+/* Hand over every packet in the samples fed so far: wait for the slicer
+ * and decoding threads, and decode the candidates that are still waiting
+ * for the next few samples (which then can not add to them).
+ */
+void demod_flush(struct demod_state *d);
+
+/* Index that the next sample fed will get */
+uint64_t demod_sample_index(const struct demod_state *d);
+
+/* Counters since demod_create(), not cleared by demod_reset(). The slicer
+ * threads update theirs as they go, demod_flush() first to have them all.
+ */
+void demod_get_stats(const struct demod_state *d, struct demod_stats *stats);
+
+void demod_destroy(struct demod_state *d);
+
+#endif
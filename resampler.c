@@ -0,0 +1,252 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// resampler.c: rational polyphase resampler, brings I/Q streams at other
+// sample rates to the demodulator sample rate.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Resampling by L / M is upsampling by L (inserting L - 1 zeros between
+// input samples), low-pass filtering and keeping every M-th sample. Only
+// the kept samples are computed, and of the filter taps only the ones that
+// fall on real input samples: output sample n is at input sample
+// n * M / L, and it takes the taps p, p + L, p + 2L... of the filter, where
+// p = n * M mod L is its phase. The filter is stored by phase, so each
+// output sample is one dot product of 'taps' coefficients with the newest
+// 'taps' input samples. The input is converted a block at a time behind
+// the end of the previous one, so that the dot products read the samples
+// in one piece and never right after they are stored.
+// The filter is a Kaiser windowed sinc, sized for the transition band
+// rather than the rates: the cost per output sample only depends on how
+// fast the input rate is compared to the transition band.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "resampler.h"
+
+#define INPUT_BLOCK  1024           // Input samples converted at once
+#define OUTPUT_BLOCK 256            // Output samples handed over at once
+#define STOPBAND_DB  60.            // Attenuation of whatever would alias
+
+struct resampler {
+    // Filter taps, by phase: phase p is coeff + p * taps, oldest input
+    // sample first. Scaled by the interpolation factor, for unity gain.
+    float *coeff;
+
+    // Input, oldest sample first: the last taps - 1 samples of the
+    // previous block, then the current block
+    float in_re[RESAMPLER_MAX_TAPS + INPUT_BLOCK], in_im[RESAMPLER_MAX_TAPS + INPUT_BLOCK];
+    unsigned phase;                 // Of the next output sample, past the newest input sample while >= interpolation
+
+    unsigned interpolation, decimation, taps;
+    double delay;
+
+    int8_t out[OUTPUT_BLOCK * 2];
+    unsigned nout;
+
+    resampler_output_fn output;
+    void *opaque;
+};
+
+static unsigned gcd(unsigned a, unsigned b) {
+    while (b) {
+        unsigned t = a % b;
+
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Modified Bessel function of the first kind, order 0, for the window
+static double bessel0(double x) {
+    double sum = 1, term = 1;
+    unsigned k;
+
+    for (k = 1; term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+struct resampler *resampler_create(uint32_t input_rate, uint32_t output_rate, resampler_output_fn output, void *opaque) {
+    struct resampler *r;
+    double cutoff, transition, beta, center, t, x, sum, *h;
+    unsigned g, n, length, p, k;
+
+    if (!input_rate || !output_rate || !output)
+        return NULL;
+    g = gcd(input_rate, output_rate);
+    if (output_rate / g > RESAMPLER_MAX_PHASES)
+        return NULL;
+    if (!(r = calloc(1, sizeof(*r))))
+        return NULL;
+
+    r->interpolation = output_rate / g;
+    r->decimation = input_rate / g;
+    r->output = output;
+    r->opaque = opaque;
+
+    // Cut off at half the lower rate, with a transition band an eighth of
+    // that rate wide around it. Frequencies relative to the upsampled rate.
+    cutoff = (input_rate < output_rate ? input_rate : output_rate) / 2. / ((double) input_rate * r->interpolation);
+    transition = cutoff / 4;
+
+    // Kaiser's estimate of the length, rounded up to two whole vectors per
+    // phase
+    length = ceil((STOPBAND_DB - 8) / (2.285 * 2 * M_PI * transition)) + 1;
+    r->taps = ((length + r->interpolation - 1) / r->interpolation + 7) & ~7;
+    if (r->taps > RESAMPLER_MAX_TAPS) {
+        free(r);
+        return NULL;
+    }
+    length = r->taps * r->interpolation;
+    r->delay = (length - 1) / 2. / r->interpolation;
+
+    if (!(r->coeff = malloc(length * sizeof(*r->coeff))) || !(h = malloc(length * sizeof(*h)))) {
+        free(r->coeff);
+        free(r);
+        return NULL;
+    }
+
+    beta = 0.1102 * (STOPBAND_DB - 8.7);
+    center = (length - 1) / 2.;
+    for (n = 0, sum = 0; n < length; n++) {
+        t = n - center;
+        x = 2 * t / (length - 1);
+        h[n] = (t ? sin(2 * M_PI * cutoff * t) / (M_PI * t) : 2 * cutoff) * bessel0(beta * sqrt(1 - x * x)) / bessel0(beta);
+        sum += h[n];
+    }
+
+    // Every phase sums to about 1 / interpolation, make up for the zeros
+    for (p = 0; p < r->interpolation; p++) {
+        for (k = 0; k < r->taps; k++)
+            r->coeff[p * r->taps + r->taps - 1 - k] = h[p + k * r->interpolation] * r->interpolation / sum;
+    }
+    free(h);
+
+    resampler_reset(r);
+    return r;
+}
+
+void resampler_ratio(const struct resampler *r, unsigned *interpolation, unsigned *decimation) {
+    *interpolation = r->interpolation;
+    *decimation = r->decimation;
+}
+
+double resampler_delay(const struct resampler *r) {
+    return r->delay;
+}
+
+void resampler_reset(struct resampler *r) {
+    memset(r->in_re, 0, sizeof(r->in_re));
+    memset(r->in_im, 0, sizeof(r->in_im));
+    r->phase = 0;
+    r->nout = 0;
+}
+
+static int8_t saturate(float v) {
+    long s = lrintf(v);
+
+    return s > 127 ? 127 : s < -128 ? -128 : s;
+}
+
+static void flushOutput(struct resampler *r) {
+    if (!r->nout)
+        return;
+    r->output(r->opaque, r->out, r->nout);
+    r->nout = 0;
+}
+
+// Compute the output sample of the given phase at input sample i of the
+// current block
+static void phaseOutput(struct resampler *r, unsigned i, unsigned phase) {
+    const float *c = r->coeff + phase * r->taps, *re = r->in_re + i, *im = r->in_im + i;
+    float sum_re, sum_im;
+    unsigned k;
+
+#ifdef __SSE2__
+    // Two vectors at a time into separate sums, so that the additions do
+    // not have to wait for each other
+    __m128 acc_re = _mm_setzero_ps(), acc_im = _mm_setzero_ps(), h;
+    __m128 acc2_re = _mm_setzero_ps(), acc2_im = _mm_setzero_ps(), h2;
+
+    for (k = 0; k < r->taps; k += 8) {
+        h = _mm_loadu_ps(c + k);
+        h2 = _mm_loadu_ps(c + k + 4);
+        acc_re = _mm_add_ps(acc_re, _mm_mul_ps(h, _mm_loadu_ps(re + k)));
+        acc_im = _mm_add_ps(acc_im, _mm_mul_ps(h, _mm_loadu_ps(im + k)));
+        acc2_re = _mm_add_ps(acc2_re, _mm_mul_ps(h2, _mm_loadu_ps(re + k + 4)));
+        acc2_im = _mm_add_ps(acc2_im, _mm_mul_ps(h2, _mm_loadu_ps(im + k + 4)));
+    }
+    acc_re = _mm_add_ps(acc_re, acc2_re);
+    acc_im = _mm_add_ps(acc_im, acc2_im);
+
+    // Add up the 4 lanes of both: re0+re2 re1+re3 im0+im2 im1+im3, then pairs
+    h = _mm_add_ps(_mm_movelh_ps(acc_re, acc_im), _mm_movehl_ps(acc_im, acc_re));
+    h = _mm_add_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum_re = _mm_cvtss_f32(h);
+    sum_im = _mm_cvtss_f32(_mm_movehl_ps(h, h));
+#else
+    for (k = 0, sum_re = sum_im = 0; k < r->taps; k++) {
+        sum_re += c[k] * re[k];
+        sum_im += c[k] * im[k];
+    }
+#endif
+
+    r->out[r->nout * 2] = saturate(sum_re);
+    r->out[r->nout * 2 + 1] = saturate(sum_im);
+    if (++r->nout == OUTPUT_BLOCK)
+        flushOutput(r);
+}
+
+void resampler_feed(struct resampler *r, const int8_t *iq, size_t n) {
+    unsigned history = r->taps - 1, phase = r->phase, len, i;
+
+    while (n) {
+        len = n < INPUT_BLOCK ? n : INPUT_BLOCK;
+        for (i = 0; i < len; i++) {
+            r->in_re[history + i] = iq[i * 2];
+            r->in_im[history + i] = iq[i * 2 + 1];
+        }
+
+        // Every output sample between each input sample and the next one
+        for (i = 0; i < len; i++) {
+            for (; phase < r->interpolation; phase += r->decimation)
+                phaseOutput(r, i, phase);
+            phase -= r->interpolation;
+        }
+
+        memmove(r->in_re, r->in_re + len, history * sizeof(*r->in_re));
+        memmove(r->in_im, r->in_im + len, history * sizeof(*r->in_im));
+        iq += len * 2;
+        n -= len;
+    }
+
+    r->phase = phase;
+    flushOutput(r);
+}
+
+void resampler_destroy(struct resampler *r) {
+    if (!r)
+        return;
+    free(r->coeff);
+    free(r);
+}
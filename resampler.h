@@ -0,0 +1,60 @@
+// Part of dump868, a FLARM message decoder for RTLSDR devices.
+//
+// resampler.h: rational polyphase resampler, brings I/Q streams at other
+// sample rates to the demodulator sample rate.
+//
+// This file is free software: you may copy, redistribute and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The output rate is the input rate times interpolation / decimation, the
+// ratio reduced to its lowest terms. Rates that do not reduce to at most
+// this many interpolation phases are not supported.
+#define RESAMPLER_MAX_PHASES 256
+#define RESAMPLER_MAX_TAPS   128            // Filter taps per phase
+
+// Called with every block of output samples: n signed 8-bit I/Q pairs. The
+// block is only valid during the call.
+typedef void (*resampler_output_fn)(void *opaque, const int8_t *iq, size_t n);
+
+struct resampler;
+
+// Convert from input_rate to output_rate, keeping what is within 7/16 of
+// the lower of both rates around DC. Returns NULL if the rates are not
+// supported or we are out of memory.
+struct resampler *resampler_create(uint32_t input_rate, uint32_t output_rate, resampler_output_fn output, void *opaque);
+
+// Interpolation and decimation factors: every 'decimation' input samples
+// make 'interpolation' output samples
+void resampler_ratio(const struct resampler *r, unsigned *interpolation, unsigned *decimation);
+
+// Filter delay, in input samples: output sample m is the signal around
+// input sample m * decimation / interpolation - resampler_delay()
+double resampler_delay(const struct resampler *r);
+
+// Forget the signal history. The next input sample is the one output
+// sample 0 is aligned to.
+void resampler_reset(struct resampler *r);
+
+// Resample n signed 8-bit I/Q pairs. Whatever output is pending at the end
+// is handed over before returning.
+void resampler_feed(struct resampler *r, const int8_t *iq, size_t n);
+
+void resampler_destroy(struct resampler *r);
+
+#endif
@@ -0,0 +1,180 @@
+/* sdft_test, long-run drift of the sliding DFT engines
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Feeds pseudo-random I/Q samples, in blocks of random length, through every
+// sliding DFT engine. The float engines (scalar, SSE2 and AVX2, where this
+// CPU has them) have to give bit for bit the same output. At every power of
+// 10 samples, the bins of dft_block_int() and dft_block_scalar() are also
+// recomputed from the last 16 samples in the I/Q ring: the integer bins have
+// to match exactly, and the float error is printed next to them. Build with
+// "make sdft_test", run as "./sdft_test [samples]" (default 10^10, about 20
+// minutes). nrf905_demod.c is included rather than linked, to reach the
+// engines and their state. Exits with 1 on any mismatch.
+
+#include "nrf905_demod.c"
+
+#define DEFAULT_SAMPLES 10000000000ULL
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+// xorshift64*
+static uint64_t random64(void) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545f4914f6cdd1dULL;
+}
+
+// 4 I/Q pairs at a time
+static void random_block(int8_t *iq, unsigned n) {
+    uint64_t x;
+    unsigned k;
+
+    for (k = 0; k < n * 2; k += 8) {
+        x = random64();
+        memcpy(iq + k, &x, 8);
+    }
+}
+
+static const struct {
+    const char *name;
+    enum demod_dft_engine engine;
+} engines[] = {
+    { "integer", DEMOD_DFT_INT },
+    { "scalar", DEMOD_DFT_SCALAR },     // What the vector engines are held to
+    { "SSE2", DEMOD_DFT_SSE2 },
+    { "AVX2", DEMOD_DFT_AVX2 },
+};
+
+#define ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+// 5 channels, 10 lanes in use out of 12: whole SSE2 vectors, but the second
+// AVX2 one only half full
+static struct demod_state *create(unsigned e) {
+    struct demod_config config;
+    struct demod_state *d;
+    unsigned c;
+
+    demod_default_config(&config);
+    config.dft_engine = engines[e].engine;
+    config.channels = 5;
+    for (c = 0; c < config.channels; c++) {
+        config.channel[c].space_bin = c * 3 + 1;
+        config.channel[c].mark_bin = c * 3 + 2;
+    }
+    if (!(d = demod_create(&config, NULL, NULL))) {
+        fprintf(stderr, "Can not create the %s demodulator.\n", engines[e].name);
+        exit(1);
+    }
+    return d;
+}
+
+// Integer bins that differ from the twiddled sum of the last dft_points
+// samples. 'fed' samples went in since the reset, the first at phase 0.
+static unsigned int_errors(struct demod_state *d, uint64_t fed) {
+    struct iq_sample x;
+    int64_t re, im;
+    unsigned b, j, phase, errors = 0;
+
+    for (b = 0; b < d->lanes; b++) {
+        for (j = 0, re = im = 0; j < dft_points; j++) {
+            x = cb_readn(iq, j);
+            phase = (fed - 1 - j) & (dft_points - 1);
+            re += x.i * d->twiddle_re[b][phase] - x.q * d->twiddle_im[b][phase];
+            im += x.i * d->twiddle_im[b][phase] + x.q * d->twiddle_re[b][phase];
+        }
+        errors += re != d->sdft_re[b] || im != d->sdft_im[b];
+    }
+    return errors;
+}
+
+// Largest distance of a float bin from the DFT of the last dft_points
+// samples: the newest one rotated once by the coefficient, the oldest 16
+// times
+static double float_error(struct demod_state *d) {
+    struct iq_sample x;
+    complex double exact;
+    double error, worst = 0;
+    unsigned b, j;
+
+    for (b = 0; b < d->lanes; b++) {
+        for (j = 0, exact = 0; j < dft_points; j++) {
+            x = cb_readn(iq, j);
+            exact += (x.i + I * x.q) * cpow(d->coeffs[b], j + 1);
+        }
+        error = cabs(d->dft[b] - exact);
+        if (error > worst)
+            worst = error;
+    }
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    static int8_t iq[DEMOD_BLOCK_SAMPLES * 2 + 8];     // random_block() writes 4 pairs at a time
+    static int32_t diff[ENGINES][dft_lanes / 2][DEMOD_BLOCK_SAMPLES];
+    struct demod_state *d[ENGINES] = { NULL };
+    uint64_t samples = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_SAMPLES;
+    uint64_t fed = 0, check = 1000;
+    unsigned e, c, errors, failed = 0, n;
+
+    for (e = 0; e < ENGINES; e++) {
+        if (demod_dft_engine_supported(engines[e].engine))
+            d[e] = create(e);
+        else
+            printf("No %s engine on this CPU, skipped.\n", engines[e].name);
+    }
+
+    printf("%14s %20s %18s\n", "samples", "integer bins off", "float bin error");
+    while (fed < samples) {
+        n = random64() % DEMOD_BLOCK_SAMPLES + 1;
+        if (n > check - fed)
+            n = check - fed;
+        if (n > samples - fed)
+            n = samples - fed;
+
+        random_block(iq, n);
+        for (e = 0; e < ENGINES; e++)
+            if (d[e])
+                d[e]->dft_block(d[e], iq, n, diff[e]);
+        fed += n;
+
+        // Every float engine against the scalar one, over the samples of the block
+        for (e = 2; e < ENGINES; e++) {
+            if (!d[e])
+                continue;
+            for (c = 0; c < d[e]->lanes / 2; c++) {
+                if (memcmp(diff[e][c], diff[1][c], n * sizeof(diff[e][c][0]))) {
+                    printf("%s differs from scalar on channel %u, in the block ending at sample %llu\n",
+                           engines[e].name, c, (unsigned long long) fed);
+                    return 1;
+                }
+            }
+        }
+
+        if (fed == check || fed == samples) {
+            errors = int_errors(d[0], fed);
+            failed |= errors;
+            printf("%14llu %13u of %-4u %18.6f\n", (unsigned long long) fed, errors, d[0]->lanes, float_error(d[1]));
+            fflush(stdout);
+            if (fed == check)
+                check *= 10;
+        }
+    }
+
+    for (e = 0; e < ENGINES; e++)
+        demod_destroy(d[e]);
+    return failed ? 1 : 0;
+}
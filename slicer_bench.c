@@ -0,0 +1,125 @@
+/* slicer_bench, preamble matching microbenchmark
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Slices the same sliding sums both ways and looks for the preamble at every
+// sample: the byte per symbol ring scanned one symbol at a time, as the
+// demodulator used to, against the bitmap rows checked with one XOR and a
+// popcount. Some preambles are planted in the noise, and both have to count
+// the same matches before they are timed. Build with "make slicer_bench".
+// nrf905_demod.c is included rather than linked, to reach the bitmap.
+
+#include "nrf905_demod.c"
+
+#include <time.h>
+
+#define SAMPLES     (1 << 20)   // Sliding sums cycled through
+#define ROUNDS      20
+#define PLANTED     256         // Preambles among them
+
+static int32_t sums[SAMPLES];
+
+// The byte per symbol ring, with the names cb_write() and cb_readn() expect
+struct byte_slicer {
+    uint16_t cb_idx_bit;
+    uint8_t cb_buf_bit[buffer_size];
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned byte_scan(struct byte_slicer *d) {
+    unsigned n, i, j, found = 0;
+
+    for (n = 0; n < SAMPLES; n++) {
+        cb_write(bit, sums[n] > 0 ? 1 : 0);
+        for (i = packet_samples, j = 0; j < preamble_bits; i -= symbol_samples, j++) {
+            if (preamble_pattern[j] != cb_readn(bit, i))
+                break;
+        }
+        found += j == preamble_bits;
+    }
+    return found;
+}
+
+static unsigned bitmap_check(struct demod_state *d) {
+    unsigned n, found = 0;
+    uint32_t mismatch;
+
+    for (n = 0; n < SAMPLES; n++) {
+        symbol_write(d, 0, sums[n]);
+        mismatch = (symbol_row(d, 0, packet_samples) ^ d->preamble_word) & ((1U << preamble_bits) - 1);
+        found += !mismatch || __builtin_popcount(mismatch) <= d->config.preamble_errors;
+    }
+    return found;
+}
+
+int main(void) {
+    static struct byte_slicer slicer;
+    volatile unsigned sink = 0;
+    struct demod_config config;
+    struct demod_state *d;
+    unsigned n, k, r, found[2];
+    double start, elapsed, best[2] = { 1e9, 1e9 };
+
+    demod_default_config(&config);
+    config.channels = 1;
+    config.preamble_errors = 0;
+    if (!(d = demod_create(&config, NULL, NULL))) {
+        fprintf(stderr, "Can not create the demodulator.\n");
+        return 1;
+    }
+
+    srand(1);
+    for (n = 0; n < SAMPLES; n++)
+        sums[n] = rand() - RAND_MAX / 2;
+    for (k = 0; k < PLANTED; k++) {
+        n = (k * 2 + 1) * (SAMPLES / PLANTED / 2);
+        for (r = 0; r < preamble_bits * symbol_samples; r++)
+            sums[n + r] = preamble_pattern[r / symbol_samples] ? 1000 : -1000;
+    }
+
+    found[0] = byte_scan(&slicer);
+    found[1] = bitmap_check(d);
+    if (found[0] != found[1] || found[0] < PLANTED) {
+        fprintf(stderr, "Preambles found: %u by the byte scan, %u by the bitmap, %d planted\n", found[0], found[1], PLANTED);
+        return 1;
+    }
+
+    for (r = 0; r < ROUNDS; r++) {
+        start = now();
+        sink += byte_scan(&slicer);
+        elapsed = now() - start;
+        if (elapsed < best[0])
+            best[0] = elapsed;
+
+        start = now();
+        sink += bitmap_check(d);
+        elapsed = now() - start;
+        if (elapsed < best[1])
+            best[1] = elapsed;
+    }
+
+    printf("%d samples, %u preamble matches, ns per sample (best of %d):\n", SAMPLES, found[0], ROUNDS);
+    printf("  %-22s %6.2f\n", "byte ring, 20 reads", best[0] * 1e9 / SAMPLES);
+    printf("  %-22s %6.2f\n", "bitmap, XOR + popcount", best[1] * 1e9 / SAMPLES);
+
+    demod_destroy(d);
+    return 0;
+}
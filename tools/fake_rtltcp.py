@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Fake rtl_tcp server, replays a CU8 capture for testing --rtltcp.
+
+Sends the rtl_tcp header (R820T, 29 gains), prints the commands dump868
+sends back on stderr, then streams the capture paced at --rate. Each
+connection starts with --junk bytes of silence, like the samples a real
+dongle produces before it is retuned; dump868 discards them.
+
+Usage:
+
+  Plain replay, the frames must be the same as with --ifile:
+    tools/fake_rtltcp.py capture.cu8 --port 12345 &
+    ./dump868 --rtltcp 127.0.0.1:12345 --raw
+
+  A stall: at byte 8000000 the server stops for 2 s and the samples of
+  those 2 s are lost, dump868 has to report them:
+    tools/fake_rtltcp.py capture.cu8 --stall 8000000 --stall-len 2
+
+  A reconnect: the first connection is closed after 8000000 bytes and 1 s
+  of capture is skipped before the second one:
+    tools/fake_rtltcp.py capture.cu8 --cut 8000000 --outage 1
+
+  A dongle whose crystal is 100 ppm fast, nothing should be reported lost:
+    tools/fake_rtltcp.py capture.cu8 --ppm 100
+
+  IPv6, and a server that does not speak rtl_tcp:
+    tools/fake_rtltcp.py capture.cu8 --host ::1 &
+    ./dump868 --rtltcp [::1]:12345
+    tools/fake_rtltcp.py capture.cu8 --bad
+"""
+
+import argparse
+import socket
+import sys
+import threading
+import time
+
+CHUNK = 32768
+
+
+def commands(conn):
+    buf = b''
+    while True:
+        try:
+            data = conn.recv(100)
+        except OSError:
+            return
+        if not data:
+            return
+        buf += data
+        while len(buf) >= 5:
+            print('cmd %#04x %d' % (buf[0], int.from_bytes(buf[1:5], 'big', signed=True)), file=sys.stderr, flush=True)
+            buf = buf[5:]
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Replay a CU8 capture as an rtl_tcp server.')
+    ap.add_argument('file', help='CU8 capture')
+    ap.add_argument('--host', default='127.0.0.1', help='address to listen on (default: 127.0.0.1)')
+    ap.add_argument('--port', type=int, default=12345)
+    ap.add_argument('--rate', type=float, default=1.6e6, help='samples per second (default: 1.6e6)')
+    ap.add_argument('--ppm', type=float, default=0, help='stream this much faster than --rate')
+    ap.add_argument('--junk', type=int, default=800000, help='bytes of silence before the capture, on every connection')
+    ap.add_argument('--cut', type=int, default=0, help='close the first connection after this many capture bytes')
+    ap.add_argument('--outage', type=float, default=0, help='seconds of capture skipped after --cut')
+    ap.add_argument('--stall', type=int, default=0, help='pause at this capture byte, and skip what would have been sent')
+    ap.add_argument('--stall-len', type=float, default=0, help='seconds the --stall lasts')
+    ap.add_argument('--bad', action='store_true', help='answer with something that is not rtl_tcp')
+    ap.add_argument('--connections', type=int, default=2, help='connections served at most')
+    a = ap.parse_args()
+
+    data = open(a.file, 'rb').read()
+    rate = a.rate * (1 + a.ppm / 1e6)
+    family = socket.AF_INET6 if ':' in a.host else socket.AF_INET
+    srv = socket.socket(family)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind((a.host, a.port))
+    srv.listen(1)
+
+    pos = 0
+    stall = a.stall
+    for n in range(a.connections):
+        conn, _ = srv.accept()
+        if a.bad:
+            conn.sendall(b'HTTP/1.0 200 OK\r\n')
+            conn.close()
+            continue
+        conn.sendall(b'RTL0' + (5).to_bytes(4, 'big') + (29).to_bytes(4, 'big'))
+        threading.Thread(target=commands, args=(conn,), daemon=True).start()
+
+        start = time.monotonic()
+        sent = 0
+        try:
+            conn.sendall(b'\x7f' * a.junk)
+            sent += a.junk
+            while pos < len(data):
+                if a.cut and n == 0 and pos >= a.cut:
+                    pos += int(a.outage * a.rate) * 2
+                    break
+                if stall and pos <= stall < pos + CHUNK:
+                    conn.sendall(data[pos:stall])
+                    sent += stall - pos
+                    pos = stall
+                    time.sleep(a.stall_len)
+                    pos += int(a.stall_len * a.rate) * 2
+                    start += a.stall_len
+                    stall = 0
+                    continue
+                conn.sendall(data[pos:pos + CHUNK])
+                pos += CHUNK
+                sent += CHUNK
+                ahead = start + sent / 2 / rate - time.monotonic()
+                if ahead > 0:
+                    time.sleep(ahead)
+        except OSError as e:
+            print('send:', e, file=sys.stderr)
+        time.sleep(0.3)
+        conn.shutdown(socket.SHUT_RDWR)
+        conn.close()
+        if pos >= len(data):
+            break
+    time.sleep(1)
+
+
+if __name__ == '__main__':
+    main()
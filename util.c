@@ -65,17 +65,18 @@ uint64_t mstime(void)
 
 int64_t receiveclock_ns_elapsed(uint64_t t1, uint64_t t2)
 {
-    return (t2 - t1) * 1000U / 12U;
+    // Signed, t2 may well be the earlier one
+    return (int64_t) (t2 - t1) * 1000 / 12;
 }
 
 void normalize_timespec(struct timespec *ts)
 {
-    if (ts->tv_nsec > 1000000000) {
+    if (ts->tv_nsec >= 1000000000) {
         ts->tv_sec += ts->tv_nsec / 1000000000;
         ts->tv_nsec = ts->tv_nsec % 1000000000;
     } else if (ts->tv_nsec < 0) {
-        long adjust = ts->tv_nsec / 1000000000 + 1;
+        long adjust = (999999999 - ts->tv_nsec) / 1000000000;
         ts->tv_sec -= adjust;
-        ts->tv_nsec = (ts->tv_nsec + 1000000000 * adjust) % 1000000000;
+        ts->tv_nsec += 1000000000 * adjust;
     }
 }